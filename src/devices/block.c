@@ -139,6 +139,74 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK,
+   the Ith into BUFFERS[I], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  If the driver supports it, the sectors
+   are transferred BLOCK_MAX_MULTIPLE at a time.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *const buffers[])
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < BLOCK_MAX_MULTIPLE ? cnt : BLOCK_MAX_MULTIPLE;
+      size_t i;
+
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, n, buffers);
+      else
+        for (i = 0; i < n; i++)
+          block->ops->read (block->aux, sector + i, buffers[i]);
+      block->read_cnt += n;
+
+      sector += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK, the
+   Ith from BUFFERS[I], each of which must contain BLOCK_SECTOR_SIZE
+   bytes.  If the driver supports it, the sectors are transferred
+   BLOCK_MAX_MULTIPLE at a time.  Returns after the block device has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      void *const buffers[])
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < BLOCK_MAX_MULTIPLE ? cnt : BLOCK_MAX_MULTIPLE;
+      size_t i;
+
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, n, buffers);
+      else
+        for (i = 0; i < n; i++)
+          block->ops->write (block->aux, sector + i, buffers[i]);
+      block->write_cnt += n;
+
+      sector += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
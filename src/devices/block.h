@@ -53,6 +53,10 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *const buffers[]);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -61,10 +65,22 @@ void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* Most sectors passed to a driver's read_multiple or
+   write_multiple operation at once. */
+#define BLOCK_MAX_MULTIPLE 128
+
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors, the Ith to or from
+       BUFFERS[I], in as few device commands as possible.  CNT is
+       at most BLOCK_MAX_MULTIPLE. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *const buffers[]);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            void *const buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -34,6 +34,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +50,9 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +61,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not in use. */
   };
 
 /* An ATA channel (aka controller).
@@ -84,8 +90,9 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max_multiple);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -136,6 +143,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -303,12 +311,40 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 gives the most sectors the disk will transfer per
+     interrupt under READ/WRITE MULTIPLE. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D with the largest power of
+   two sectors per interrupt that is at most MAX_MULTIPLE.  Leaves
+   D's multiple member 0 if the disk does not support it. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_multiple)
+{
+  struct channel *c = d->channel;
+  int multiple;
+
+  d->multiple = 0;
+  if (max_multiple <= 1)
+    return;
+  for (multiple = 1; multiple * 2 <= max_multiple; multiple *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +373,115 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D, the Ith into
+   BUFFERS[I], each of which must have room for BLOCK_SECTOR_SIZE
+   bytes.  Uses a single READ MULTIPLE command if the disk supports
+   it, otherwise a single READ SECTOR command that interrupts once
+   per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t i, j;
+
+  ASSERT (cnt > 0 && cnt <= BLOCK_MAX_MULTIPLE);
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                        : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      for (j = i; j < cnt && j < i + per_intr; j++)
+        input_sector (c, buffers[j]);
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D, the Ith from
+   BUFFERS[I], each of which must contain BLOCK_SECTOR_SIZE bytes.
+   Uses a single WRITE MULTIPLE or WRITE SECTOR command, like
+   ide_read_multiple().  Returns after the disk has acknowledged
+   receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t i, j;
+
+  ASSERT (cnt > 0 && cnt <= BLOCK_MAX_MULTIPLE);
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                        : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      for (j = i; j < cnt && j < i + per_intr; j++)
+        output_sector (c, buffers[j]);
+      sema_down (&c->completion_wait);
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, &buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  void *buffers[1] = { (void *) buffer };
+  ide_write_multiple (d_, sec_no, 1, buffers);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and sector
+   count registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt < 256);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
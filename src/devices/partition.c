@@ -317,8 +317,30 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFERS. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, size_t cnt,
+                         void *const buffers[])
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFERS. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector, size_t cnt,
+                          void *const buffers[])
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, cnt, buffers);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple
   };
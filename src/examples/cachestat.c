@@ -0,0 +1,36 @@
+/* cachestat.c
+
+   Prints buffer cache statistics. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (void) 
+{
+  static const char *class_names[CACHE_CLASS_CNT] =
+    {"data", "inode", "indirect", "directory", "free map"};
+  struct cache_stats stats;
+  int i;
+
+  if (!cachestat (&stats)) 
+    {
+      printf ("cachestat failed\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("%-10s %10s %10s %10s %10s\n",
+          "class", "hits", "misses", "evictions", "writebacks");
+  for (i = 0; i < CACHE_CLASS_CNT; i++) 
+    {
+      const struct cache_class_stats *cs = &stats.classes[i];
+      printf ("%-10s %10llu %10llu %10llu %10llu\n", class_names[i],
+              cs->hit_cnt, cs->miss_cnt, cs->evict_cnt, cs->write_back_cnt);
+    }
+  printf ("read-ahead: %llu sectors, %llu used, %llu wasted\n",
+          stats.read_ahead_cnt, stats.read_ahead_hit_cnt,
+          stats.read_ahead_waste_cnt);
+  printf ("lock waits: %llu (%llu ticks)\n",
+          stats.lock_wait_cnt, stats.lock_wait_ticks);
+  return EXIT_SUCCESS;
+}
@@ -6,9 +6,13 @@
 
    By default, only the name of each file is printed.  If "-l" is
    given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   each file is also printed.  Names, types, and inumbers come a
+   bufferful at a time from getdents(), so only regular files
+   need to be opened, for their sizes.  This won't work until
+   project 4. */
 
 #include <syscall.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -24,38 +28,48 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      /* Room for dozens of entries, fetched in one system call. */
+      static uint32_t entries[256];
+      int size;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
+      while ((size = getdents (dir_fd, entries, sizeof entries)) > 0) 
         {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
-
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+          const uint8_t *p = (const uint8_t *) entries;
+          const uint8_t *end = p + size;
+          const struct dirent *d;
 
-              printf (": ");
-              if (entry_fd != -1)
+          for (; p < end; p += d->reclen) 
+            {
+              d = (const struct dirent *) p;
+              printf ("%s", d->name); 
+              if (verbose) 
                 {
-                  if (isdir (entry_fd))
+                  printf (": ");
+                  if (d->isdir)
                     printf ("directory");
                   else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
+                    {
+                      char full_name[128];
+                      int entry_fd;
+
+                      snprintf (full_name, sizeof full_name, "%s/%s",
+                                dir, d->name);
+                      entry_fd = open (full_name);
+                      if (entry_fd != -1)
+                        printf ("%d-byte file", filesize (entry_fd));
+                      else
+                        printf ("open failed");
+                      close (entry_fd);
+                    }
+                  printf (", inumber %d", (int) d->inumber);
                 }
-              else
-                printf ("open failed");
-              close (entry_fd);
+              printf ("\n");
             }
-          printf ("\n");
         }
     }
   else 
@@ -2,260 +2,1166 @@
 #include <list.h>
 #include <bitmap.h>
 #include <string.h>
+#include <round.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "filesys/cache.h"
 
+/* Replacement queues. */
+enum cache_queue
+  {
+    QUEUE_NONE,                         /* Being filled or evicted. */
+    QUEUE_FREE,                         /* Invalid, ready for reuse. */
+    QUEUE_PROBATION,                    /* Seen once (all sectors under clock). */
+    QUEUE_PROTECTED                     /* Re-referenced or metadata (2Q). */
+  };
+
+/* Replacement policies. */
+enum cache_policy
+  {
+    POLICY_CLOCK,                       /* Second chance over all sectors. */
+    POLICY_2Q                           /* Probation FIFO + protected clock. */
+  };
+
 struct cache_entry
   {
     block_sector_t sector;
+    enum cache_class class;
+    enum cache_queue queue;
     bool valid;
     bool dirty;
     bool accessed;
     bool loaded;
-    unsigned long long read_cnt;
-    unsigned long long write_cnt;
-    struct lock lock;
+    bool prefetched;                    /* Read ahead, not yet accessed. */
+    struct rwlock lock;                 /* Shared for reads, exclusive
+                                           for writes and loads. */
+    struct list_elem hash_elem;         /* Element in a cache_bucket. */
+    struct list_elem dirty_elem;        /* Element in dirty_list. */
+    struct list_elem queue_elem;        /* Element in a replacement queue. */
 
-    uint8_t buffer[BLOCK_SECTOR_SIZE];
+    uint8_t *buffer;                    /* BLOCK_SECTOR_SIZE bytes. */
   };
 
-struct queue_entry
+/* Number of sector buffers carved out of one page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Smallest cache, in sectors. */
+#define CACHE_MIN_SIZE 64
+
+/* Number of free user pages that must remain after the cache
+   borrows one to grow. */
+#define CACHE_GROW_RESERVE 64
+
+/* Under 2Q, the share of the cache, in percent, that the protected
+   queue may hold before its coldest entries drop back to
+   probation. */
+#define PROTECTED_SHARE 75
+
+/* How often the write-back thread wakes up to check the dirty
+   ratio, in timer ticks. */
+#define WRITE_BACK_POLL (TIMER_FREQ / 10)
+
+/* Maximum number of sectors sorted and written back as a batch. */
+#define WRITE_BACK_BATCH 64
+
+/* A bucket of the sector index.  Each bucket has its own lock, so
+   lookups of sectors that hash to different buckets never
+   contend. */
+struct cache_bucket
   {
-    int index;
-    struct list_elem elem;
+    struct list entries;                /* Valid entries in this bucket. */
+    struct lock lock;                   /* Protects ENTRIES. */
   };
 
-static struct list read_queue;
+/* Number of pending read-ahead requests.  Requests made while the
+   ring is full are dropped. */
+#define READ_AHEAD_SLOTS 64
+
+/* Ring buffer of sector runs waiting to be prefetched by the
+   read-ahead thread.  read_sema counts the requests in the ring. */
+static struct
+  {
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    enum cache_class class;
+  }
+read_ring[READ_AHEAD_SLOTS];
+static size_t read_head;                /* Next slot to fill. */
+static size_t read_tail;                /* Next slot to prefetch. */
+static struct lock read_lock;           /* Protects the ring. */
 static struct semaphore read_sema;
 
-static struct cache_entry cache[64];
+/* Sizes requested on the kernel command line, in sectors.
+   Zero means "pick a default". */
+static size_t requested_size;
+static size_t requested_max;
+
+static struct cache_entry *cache;       /* cache_max_cnt slots. */
+static size_t cache_cnt;                /* Slots backed by a buffer. */
+static size_t cache_base_cnt;           /* Slots backed by the kernel pool. */
+static size_t cache_max_cnt;            /* Upper bound on cache_cnt. */
+
+static struct cache_bucket *buckets;
+static size_t bucket_cnt;               /* Power of 2. */
+
+/* Replacement state.  Sectors enter the probation queue on a miss,
+   except that 2Q admits metadata straight to the protected queue.
+   Under 2Q a probation sector referenced again before it reaches
+   the head is promoted, so a one-time scan of file data only ever
+   cycles through probation and leaves the protected queue
+   alone. */
+static enum cache_policy cache_policy = POLICY_2Q;
+static struct list free_list;
+static struct list probation_list;
+static struct list protected_list;
+static size_t protected_cnt;
+
+/* Protects cache_cnt and the replacement queues. */
 static struct lock cache_lock;
-static int iter_idx;
+
+/* Dirty entries, in the order they were first dirtied.  An entry is
+   on this list exactly when its dirty flag is set; both change only
+   with the entry's lock and dirty_lock held. */
+static struct list dirty_list;
+static size_t dirty_cnt;
+static struct lock dirty_lock;
+
+/* Write-back tunables: every write_back_interval milliseconds, or
+   sooner once more than dirty_ratio percent of the cache is dirty,
+   the write-back thread flushes the dirty list. */
+static int write_back_interval = 1000;
+static int dirty_ratio = 20;
+
+/* Entries for sectors from CACHE_DELAYED up hold data whose disk
+   sector is not allocated yet.  They stay out of the replacement
+   queues and the dirty list, so they are never evicted or written
+   back, until cache_place() copies them to a real sector.  At most a
+   quarter of the cache may be delayed at once.  Protected by
+   cache_lock. */
+static size_t delayed_cnt;
+static block_sector_t next_delayed = CACHE_DELAYED;
+
+/* Statistics.  Updated without locking, like the block device
+   counters, so they are approximate under contention. */
+static struct cache_stats stats;
 
 void write_back (void *);
 void read_ahead (void *);
-static int cache_evict (void);
+static struct cache_entry *cache_evict (void);
+static void cache_flush (size_t max_cnt);
+
+/* Acquires LOCK, counting the time spent waiting if it is
+   contended. */
+static void
+timed_acquire (struct lock *lock)
+{
+  int64_t start;
+
+  if (lock_try_acquire (lock))
+    return;
+
+  start = timer_ticks ();
+  lock_acquire (lock);
+  stats.lock_wait_cnt++;
+  stats.lock_wait_ticks += timer_elapsed (start);
+}
+
+/* Locks C in MODE, counting the time spent waiting if it is
+   contended. */
+static void
+timed_acquire_entry (struct cache_entry *c, enum cache_mode mode)
+{
+  int64_t start;
+
+  if (mode == CACHE_SHARED ? rwlock_try_acquire_read (&c->lock)
+                           : rwlock_try_acquire_write (&c->lock))
+    return;
+
+  start = timer_ticks ();
+  if (mode == CACHE_SHARED)
+    rwlock_acquire_read (&c->lock);
+  else
+    rwlock_acquire_write (&c->lock);
+  stats.lock_wait_cnt++;
+  stats.lock_wait_ticks += timer_elapsed (start);
+}
+
+/* Sets the number of sectors the cache holds, overriding the
+   default of one eighth of the kernel pool. */
+void
+cache_configure (size_t sectors)
+{
+  requested_size = sectors;
+}
+
+/* Lets the cache grow up to SECTORS sectors by borrowing pages
+   from the user pool while they are plentiful.  The frame
+   allocator takes them back through cache_shrink(). */
+void
+cache_configure_max (size_t sectors)
+{
+  requested_max = sectors;
+}
+
+/* Sets the write-back period to MS milliseconds.  Zero disables
+   periodic write-back; dirty sectors then reach disk only on
+   eviction, at shutdown, or when the dirty ratio is exceeded. */
+void
+cache_configure_write_back (int ms)
+{
+  write_back_interval = ms;
+}
+
+/* Sets the percentage of the cache that may be dirty before the
+   write-back thread starts flushing early. */
+void
+cache_configure_dirty_ratio (int percent)
+{
+  dirty_ratio = percent;
+}
+
+/* Selects the replacement policy named NAME, "clock" or "2q".
+   Returns false if NAME is not a known policy. */
+bool
+cache_configure_policy (const char *name)
+{
+  if (!strcmp (name, "clock"))
+    cache_policy = POLICY_CLOCK;
+  else if (!strcmp (name, "2q"))
+    cache_policy = POLICY_2Q;
+  else
+    return false;
+  return true;
+}
+
+/* Moves C, which must not be in a queue, to the back of QUEUE.
+   cache_lock must be held, except during initialization. */
+static void
+cache_enqueue (struct cache_entry *c, enum cache_queue queue)
+{
+  struct list *list = (queue == QUEUE_FREE ? &free_list
+                       : queue == QUEUE_PROBATION ? &probation_list
+                       : &protected_list);
+
+  ASSERT (c->queue == QUEUE_NONE);
+
+  list_push_back (list, &c->queue_elem);
+  c->queue = queue;
+  if (queue == QUEUE_PROTECTED)
+    protected_cnt++;
+}
+
+/* Takes C out of its replacement queue.  cache_lock must be held. */
+static void
+cache_dequeue (struct cache_entry *c)
+{
+  if (c->queue == QUEUE_NONE)
+    return;
+
+  list_remove (&c->queue_elem);
+  if (c->queue == QUEUE_PROTECTED)
+    protected_cnt--;
+  c->queue = QUEUE_NONE;
+}
+
+/* Backs SECTORS_PER_PAGE more slots with a page obtained with
+   FLAGS.  Returns false if the cache is at its maximum size or
+   no page is available. */
+static bool
+cache_add_page (enum palloc_flags flags)
+{
+  uint8_t *page;
+
+  if (cache_cnt + SECTORS_PER_PAGE > cache_max_cnt)
+    return false;
+
+  page = palloc_get_page (flags);
+  if (page == NULL)
+    return false;
+
+  for (int i = 0; i < SECTORS_PER_PAGE; i++)
+  {
+    cache[cache_cnt + i].buffer = page + i * BLOCK_SECTOR_SIZE;
+    cache_enqueue (&cache[cache_cnt + i], QUEUE_FREE);
+  }
+  cache_cnt += SECTORS_PER_PAGE;
+  return true;
+}
 
 void
 cache_init (void)
 {
+  size_t kernel_sectors = palloc_count_free (0) * SECTORS_PER_PAGE;
+  size_t size = requested_size;
+
+  if (size == 0)
+    size = kernel_sectors / 8;
+  if (size < CACHE_MIN_SIZE)
+    size = CACHE_MIN_SIZE;
+  if (size > kernel_sectors / 2)
+    size = kernel_sectors / 2;
+  size = ROUND_UP (size, SECTORS_PER_PAGE);
+
+  cache_max_cnt = ROUND_UP (requested_max, SECTORS_PER_PAGE);
+  if (cache_max_cnt < size)
+    cache_max_cnt = size;
+
+  for (bucket_cnt = 16; bucket_cnt < cache_max_cnt / 2; bucket_cnt *= 2)
+    continue;
+
+  cache = calloc (cache_max_cnt, sizeof *cache);
+  buckets = calloc (bucket_cnt, sizeof *buckets);
+  if (cache == NULL || buckets == NULL)
+    PANIC ("cannot allocate buffer cache");
+
   lock_init (&cache_lock);
+  lock_init (&read_lock);
   sema_init (&read_sema, 0);
-  list_init (&read_queue);
-  for (int i = 0; i < 64; i++)
+  read_head = read_tail = 0;
+  list_init (&dirty_list);
+  lock_init (&dirty_lock);
+  dirty_cnt = 0;
+  list_init (&free_list);
+  list_init (&probation_list);
+  list_init (&protected_list);
+  protected_cnt = 0;
+  for (size_t i = 0; i < cache_max_cnt; i++)
   {
-    lock_init (&cache[i].lock);
+    rwlock_init (&cache[i].lock);
     cache[i].valid = 0;
+    cache[i].queue = QUEUE_NONE;
+  }
+  for (size_t i = 0; i < bucket_cnt; i++)
+  {
+    list_init (&buckets[i].entries);
+    lock_init (&buckets[i].lock);
   }
-  iter_idx = 0;
+
+  cache_cnt = 0;
+  while (cache_cnt < size)
+    if (!cache_add_page (PAL_ASSERT))
+      NOT_REACHED ();
+  cache_base_cnt = cache_cnt;
   thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
-  // thread_create ("write-back", PRI_DEFAULT, write_back, NULL);
+  thread_create ("write-back", PRI_DEFAULT, write_back, NULL);
 }
 
-/* Find cache entry and return it. If not found, allocate a new entry and return it.
-   Data is not read into buffer yet */
-static int
-cache_allocate (block_sector_t sector)
+/* Marks C dirty.  C must be locked exclusively. */
+static void
+cache_mark_dirty (struct cache_entry *c)
 {
-  int idx = -1;
+  ASSERT (rwlock_held_by_current_thread (&c->lock));
 
-  lock_acquire (&cache_lock);
-  for (int i = 0; i < 64; i ++)
+  if (c->dirty || c->sector >= CACHE_DELAYED)
+    return;
+
+  lock_acquire (&dirty_lock);
+  list_push_back (&dirty_list, &c->dirty_elem);
+  dirty_cnt++;
+  c->dirty = 1;
+  lock_release (&dirty_lock);
+}
+
+/* Marks C clean.  C must be locked, at least shared, so two
+   threads writing it back may race to get here. */
+static void
+cache_mark_clean (struct cache_entry *c)
+{
+  lock_acquire (&dirty_lock);
+  if (c->dirty)
   {
-    if (cache[i].sector == sector && cache[i].valid)
-    {
-      lock_acquire (&cache[i].lock);
-      lock_release (&cache_lock);
-      return i;
-    }
-    else if (!cache[i].valid)
-      idx = i;
+    list_remove (&c->dirty_elem);
+    dirty_cnt--;
+    c->dirty = 0;
   }
+  lock_release (&dirty_lock);
+}
+
+/* Returns true if more than dirty_ratio percent of the cache is
+   dirty. */
+static bool
+cache_over_dirty_ratio (void)
+{
+  return dirty_cnt * 100 > cache_cnt * dirty_ratio;
+}
+
+static struct cache_bucket *
+bucket_of (block_sector_t sector)
+{
+  return &buckets[sector & (bucket_cnt - 1)];
+}
+
+/* Returns the entry for SECTOR in bucket B, or a null pointer if
+   there is none.  B's lock must be held. */
+static struct cache_entry *
+bucket_find (struct cache_bucket *b, block_sector_t sector)
+{
+  struct list_elem *e;
 
-  if (idx != -1)
+  ASSERT (lock_held_by_current_thread (&b->lock));
+
+  for (e = list_begin (&b->entries); e != list_end (&b->entries);
+       e = list_next (e))
   {
-    lock_acquire (&cache[idx].lock);
+    struct cache_entry *c = list_entry (e, struct cache_entry, hash_elem);
+    if (c->sector == sector)
+      return c;
   }
-  else
+  return NULL;
+}
+
+/* Gets a free slot for SECTOR, of class CLASS, and publishes it in
+   the index unless another thread inserted SECTOR while we were
+   evicting.  Returns the new entry locked exclusively and not yet
+   loaded, or a null pointer if we lost the race. */
+static struct cache_entry *
+cache_insert (block_sector_t sector, enum cache_class class)
+{
+  struct cache_bucket *b = bucket_of (sector);
+  struct cache_entry *c = cache_evict ();
+
+  timed_acquire (&b->lock);
+  if (bucket_find (b, sector) == NULL)
   {
-    idx = cache_evict ();
-  }
+    c->sector = sector;
+    c->class = class;
+    c->valid = 1;
+    c->accessed = 0;
+    c->loaded = 0;
+    c->prefetched = 0;
+    list_push_back (&b->entries, &c->hash_elem);
+    lock_release (&b->lock);
 
-  // Insert here
-  cache[idx].sector = sector;
-  cache[idx].valid = 1;
-  cache[idx].dirty = 0;
-  cache[idx].accessed = 0;
-  cache[idx].read_cnt = 0;
-  cache[idx].write_cnt = 0;
-  cache[idx].loaded = 0;
+    if (sector < CACHE_DELAYED)
+    {
+      timed_acquire (&cache_lock);
+      cache_enqueue (c, (cache_policy == POLICY_2Q && class != CACHE_DATA
+                         ? QUEUE_PROTECTED : QUEUE_PROBATION));
+      lock_release (&cache_lock);
+    }
+    return c;
+  }
+  lock_release (&b->lock);
 
+  /* Lost the race; C goes back to the free queue.  It stays locked
+     until it is there, or cache_shrink() could take its page while
+     it is on no queue at all. */
+  lock_acquire (&cache_lock);
+  cache_enqueue (c, QUEUE_FREE);
   lock_release (&cache_lock);
+  rwlock_release (&c->lock);
+  return NULL;
+}
+
+/* Find cache entry and return it locked in MODE. If not found,
+   allocate a new entry of class CLASS and return it locked
+   exclusively, whatever MODE is, so the caller can load it; only
+   such new entries are returned with loaded false.
+
+   The bucket lock is never held while waiting for an entry lock, so
+   after acquiring an entry found in the index we must check that it
+   was not evicted in the meantime. */
+static struct cache_entry *
+cache_allocate (block_sector_t sector, enum cache_class class,
+                enum cache_mode mode)
+{
+  struct cache_bucket *b = bucket_of (sector);
+  struct cache_entry *c;
 
-  return idx;
+  while (1)
+  {
+    timed_acquire (&b->lock);
+    c = bucket_find (b, sector);
+    lock_release (&b->lock);
+
+    if (c != NULL)
+    {
+      timed_acquire_entry (c, mode);
+      if (c->valid && c->sector == sector)
+        return c;
+      rwlock_release (&c->lock);
+      continue;
+    }
+
+    c = cache_insert (sector, class);
+    if (c != NULL)
+      return c;
+  }
 }
 
 static void
 cache_load (struct cache_entry *cache_entry)
 {
   ASSERT (cache_entry != NULL);
-
+  ASSERT (cache_entry->sector < CACHE_DELAYED);
 
   memset (cache_entry->buffer, 0, BLOCK_SECTOR_SIZE);
   block_read (fs_device, cache_entry->sector, cache_entry->buffer);
   cache_entry->loaded = 1;
 }
 
-static int
-cache_evict (void)
+/* Writes C back if it is dirty and removes it from the index,
+   counting it as an eviction.  C must be locked exclusively. */
+static void
+cache_invalidate (struct cache_entry *c)
+{
+  struct cache_bucket *b;
+
+  ASSERT (rwlock_held_by_current_thread (&c->lock));
+
+  if (!c->valid)
+    return;
+
+  // Write back before unpublishing, so a concurrent miss on this
+  // sector cannot read stale data from disk.
+  if (c->dirty)
+  {
+    block_write (fs_device, c->sector, c->buffer);
+    cache_mark_clean (c);
+    stats.classes[c->class].write_back_cnt++;
+  }
+  stats.classes[c->class].evict_cnt++;
+  if (c->prefetched)
+    stats.read_ahead_waste_cnt++;
+
+  b = bucket_of (c->sector);
+  lock_acquire (&b->lock);
+  list_remove (&c->hash_elem);
+  lock_release (&b->lock);
+  c->valid = 0;
+}
+
+/* Picks a victim and returns it with its lock held, out of every
+   replacement queue.  Free entries are used first.  Otherwise the
+   head of the probation queue is taken, or of the protected queue
+   if probation is empty, giving recently accessed entries a second
+   chance.  Dirty entries are passed over until every entry has been
+   looked at once, leaving their write-back to the write-back thread.
+   cache_lock must be held. */
+static struct cache_entry *
+cache_choose_victim (void)
 {
+  size_t dirty_skips = 0;
+  size_t busy_cnt = 0;
+
   while (1)
   {
-    for (int i = iter_idx; i < 64; i++)
+    struct cache_entry *c;
+    struct list *list;
+
+    if (!list_empty (&free_list))
     {
-      ASSERT (cache[i].valid == 1);
-      if (cache[i].accessed)
-        cache[i].accessed = 0;
-      else if (cache[i].loaded)
-      {
-        if (lock_try_acquire (&cache[i].lock))
-        {
-          iter_idx = i + 1;
-          // Write back
-          if (cache[i].dirty)
-            block_write (fs_device, cache[i].sector, cache[i].buffer);
+      c = list_entry (list_front (&free_list), struct cache_entry, queue_elem);
+      cache_dequeue (c);
+      if (rwlock_try_acquire_write (&c->lock))
+        return c;
+      /* Someone is still looking at this stale entry. */
+      cache_enqueue (c, QUEUE_FREE);
+    }
 
-          return i;
-        }
+    /* Under 2Q, keep the protected queue within its share by moving
+       its coldest entries back to probation. */
+    if (cache_policy == POLICY_2Q
+        && protected_cnt * 100 > cache_cnt * PROTECTED_SHARE)
+    {
+      c = list_entry (list_front (&protected_list), struct cache_entry,
+                      queue_elem);
+      cache_dequeue (c);
+      if (c->accessed)
+      {
+        c->accessed = 0;
+        cache_enqueue (c, QUEUE_PROTECTED);
       }
+      else
+        cache_enqueue (c, QUEUE_PROBATION);
+      continue;
+    }
+
+    if (!list_empty (&probation_list))
+      list = &probation_list;
+    else if (!list_empty (&protected_list))
+      list = &protected_list;
+    else
+      list = NULL;
+
+    if (list == NULL || busy_cnt > cache_cnt)
+    {
+      /* Every entry is in use by another thread, which may be waiting
+         for cache_lock. */
+      busy_cnt = 0;
+      lock_release (&cache_lock);
+      thread_yield ();
+      lock_acquire (&cache_lock);
+      continue;
+    }
+
+    c = list_entry (list_front (list), struct cache_entry, queue_elem);
+    enum cache_queue queue = c->queue;
+    cache_dequeue (c);
+
+    if (c->accessed)
+    {
+      c->accessed = 0;
+      cache_enqueue (c, cache_policy == POLICY_2Q ? QUEUE_PROTECTED : queue);
+    }
+    else if (c->dirty && dirty_skips++ < cache_cnt)
+      cache_enqueue (c, queue);
+    else if (rwlock_try_acquire_write (&c->lock))
+      return c;
+    else
+    {
+      busy_cnt++;
+      cache_enqueue (c, queue);
+    }
+  }
+}
+
+/* Returns an invalid cache entry with its lock held. A valid victim
+   is written back and removed from the index before returning.
+   Grows the cache first, if allowed and the user pool has pages to
+   spare. */
+static struct cache_entry *
+cache_evict (void)
+{
+  struct cache_entry *c;
+
+  timed_acquire (&cache_lock);
+  if (cache_cnt < cache_max_cnt
+      && palloc_count_free (PAL_USER) > CACHE_GROW_RESERVE)
+    cache_add_page (PAL_USER);
+  c = cache_choose_victim ();
+  lock_release (&cache_lock);
+
+  cache_invalidate (c);
+  return c;
+}
+
+/* Gives the most recently borrowed user page back to the user
+   pool, writing back the sectors it held.  Returns false if the
+   cache holds no user pages or the sectors in the last one are in
+   use. */
+bool
+cache_shrink (void)
+{
+  struct cache_entry *chunk;
+  void *page = NULL;
+  int i;
+
+  lock_acquire (&cache_lock);
+  if (cache_cnt <= cache_base_cnt)
+  {
+    lock_release (&cache_lock);
+    return false;
+  }
+
+  chunk = &cache[cache_cnt - SECTORS_PER_PAGE];
+  for (i = 0; i < SECTORS_PER_PAGE; i++)
+  {
+    if (!rwlock_try_acquire_write (&chunk[i].lock))
+      break;
+    if (chunk[i].valid && chunk[i].sector >= CACHE_DELAYED)
+    {
+      /* Delayed data has nowhere to go. */
+      rwlock_release (&chunk[i].lock);
+      break;
+    }
+  }
+
+  if (i == SECTORS_PER_PAGE)
+  {
+    page = chunk[0].buffer;
+    for (int j = 0; j < SECTORS_PER_PAGE; j++)
+    {
+      cache_invalidate (&chunk[j]);
+      cache_dequeue (&chunk[j]);
+      chunk[j].buffer = NULL;
     }
-    iter_idx = 0;
+    cache_cnt -= SECTORS_PER_PAGE;
+  }
+
+  while (i-- > 0)
+    rwlock_release (&chunk[i].lock);
+  lock_release (&cache_lock);
+
+  if (page != NULL)
+    palloc_free_page (page);
+  return page != NULL;
+}
+
+/* Returns SECTOR's cache entry, locked in MODE and filled from
+   disk if necessary.  The entry stays pinned in the cache, and
+   cache_buffer() points into it, until it is passed to cache_put().
+   Any number of threads may hold a sector shared at once.  A thread
+   must not get a sector it already holds. */
+struct cache_entry *
+cache_get (block_sector_t sector, enum cache_class class,
+           enum cache_mode mode)
+{
+  struct cache_entry *c = cache_allocate (sector, class, mode);
+
+  if (c->loaded)
+  {
+    stats.classes[c->class].hit_cnt++;
+    if (c->prefetched)
+    {
+      stats.read_ahead_hit_cnt++;
+      c->prefetched = 0;
+    }
+  }
+  else
+  {
+    stats.classes[c->class].miss_cnt++;
+    cache_load (c);
+    if (mode == CACHE_SHARED)
+      rwlock_downgrade (&c->lock);
+  }
+  c->accessed = 1;
+  return c;
+}
+
+/* Like cache_get() in exclusive mode, but fills the buffer with
+   zeros instead of reading SECTOR, for a newly allocated sector.
+   The entry should be put back dirty. */
+struct cache_entry *
+cache_get_zeroed (block_sector_t sector, enum cache_class class)
+{
+  struct cache_entry *c = cache_allocate (sector, class, CACHE_EXCLUSIVE);
+
+  memset (c->buffer, 0, BLOCK_SECTOR_SIZE);
+  c->loaded = 1;
+  c->prefetched = 0;
+  c->accessed = 1;
+  return c;
+}
+
+/* Gets a zeroed buffer for data whose disk sector will be allocated
+   later, and stores the placeholder sector number that names it into
+   *SECTORP.  Returns the entry locked exclusively, like
+   cache_get_zeroed(), or a null pointer if too much of the cache is
+   already delayed.  The buffer stays in the cache, and can be gotten
+   again through its placeholder, until it is passed to cache_place()
+   or cache_discard(). */
+struct cache_entry *
+cache_get_delayed (enum cache_class class, block_sector_t *sectorp)
+{
+  lock_acquire (&cache_lock);
+  if (delayed_cnt >= cache_cnt / 4)
+  {
+    lock_release (&cache_lock);
+    return NULL;
   }
+  delayed_cnt++;
+  *sectorp = next_delayed++;
+  if (next_delayed == 0)
+    next_delayed = CACHE_DELAYED;
+  lock_release (&cache_lock);
+
+  return cache_get_zeroed (*sectorp, class);
 }
 
+/* Frees entry C, which must be locked exclusively, without writing
+   it anywhere. */
+static void
+cache_free_entry (struct cache_entry *c)
+{
+  struct cache_bucket *b = bucket_of (c->sector);
+  bool delayed = c->sector >= CACHE_DELAYED;
+
+  cache_mark_clean (c);
+  lock_acquire (&b->lock);
+  list_remove (&c->hash_elem);
+  lock_release (&b->lock);
+  c->valid = 0;
+
+  lock_acquire (&cache_lock);
+  if (delayed)
+    delayed_cnt--;
+  cache_dequeue (c);
+  cache_enqueue (c, QUEUE_FREE);
+  lock_release (&cache_lock);
+  rwlock_release (&c->lock);
+}
+
+/* Copies the data held under placeholder DELAYED, from
+   cache_get_delayed(), to newly allocated SECTOR, and frees the
+   placeholder. */
+void
+cache_place (block_sector_t delayed, block_sector_t sector)
+{
+  struct cache_entry *d = cache_allocate (delayed, CACHE_DATA,
+                                          CACHE_EXCLUSIVE);
+  struct cache_entry *c;
+
+  ASSERT (d->loaded);
+  c = cache_get_zeroed (sector, d->class);
+  memcpy (c->buffer, d->buffer, BLOCK_SECTOR_SIZE);
+  cache_put (c, true);
+  cache_free_entry (d);
+}
+
+/* Frees the data held under placeholder SECTOR, from
+   cache_get_delayed(), or drops the cached copy of disk SECTOR, if
+   any, without writing it back, for a sector about to be freed. */
 void
-cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+cache_discard (block_sector_t sector)
 {
-  int idx = cache_allocate (sector);
+  struct cache_bucket *b = bucket_of (sector);
+  struct cache_entry *c;
 
-  if (!cache[idx].loaded)
-    cache_load (&cache[idx]);
+  if (sector >= CACHE_DELAYED)
+  {
+    c = cache_allocate (sector, CACHE_DATA, CACHE_EXCLUSIVE);
+    ASSERT (c->loaded);
+    cache_free_entry (c);
+    return;
+  }
 
-  memcpy (cache[idx].buffer + ofs, buffer, size);
-  cache[idx].dirty = 1;
-  cache[idx].accessed = 1;
-  lock_release (&cache[idx].lock);
+  timed_acquire (&b->lock);
+  c = bucket_find (b, sector);
+  lock_release (&b->lock);
+  if (c == NULL)
+    return;
+  timed_acquire_entry (c, CACHE_EXCLUSIVE);
+  if (c->valid && c->sector == sector)
+    cache_free_entry (c);
+  else
+    rwlock_release (&c->lock);
+}
+
+/* Returns the BLOCK_SECTOR_SIZE bytes of data cached in C, which
+   must have been obtained from cache_get(). */
+void *
+cache_buffer (struct cache_entry *c)
+{
+  ASSERT (c->valid && c->loaded);
+  return c->buffer;
+}
+
+/* Releases C, obtained from cache_get().  DIRTY must be true if the
+   buffer was modified, which requires exclusive mode. */
+void
+cache_put (struct cache_entry *c, bool dirty)
+{
+  if (dirty)
+    cache_mark_dirty (c);
+  rwlock_release (&c->lock);
 }
 
+void
+cache_write_at (block_sector_t sector, enum cache_class class,
+                const void *buffer, int ofs, int size)
+{
+  struct cache_entry *c = cache_get (sector, class, CACHE_EXCLUSIVE);
+
+  memcpy (c->buffer + ofs, buffer, size);
+  cache_put (c, true);
+}
 
 void
-cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+cache_read_at (block_sector_t sector, enum cache_class class,
+               void *buffer, int ofs, int size)
 {
-  int idx = cache_allocate (sector);
+  struct cache_entry *c = cache_get (sector, class, CACHE_SHARED);
 
-  if (!cache[idx].loaded)
-    cache_load (&cache[idx]);
+  memcpy (buffer, c->buffer + ofs, size);
+  cache_put (c, false);
+}
+
+/* Loads the N entries in RUN, which hold consecutive sectors and
+   are locked exclusively, with one disk request, marks them read
+   ahead, and releases them. */
+static void
+cache_load_run (struct cache_entry **run, size_t n)
+{
+  void *buffers[BLOCK_MAX_MULTIPLE];
+  size_t i;
 
-  memcpy (buffer, cache[idx].buffer + ofs, size);
-  cache[idx].accessed = 1;
-  lock_release (&cache[idx].lock);
+  if (n == 0)
+    return;
 
+  for (i = 0; i < n; i++)
+    buffers[i] = run[i]->buffer;
+  block_read_multiple (fs_device, run[0]->sector, n, buffers);
 
-  // Read ahead
-  if (sector + 1 < block_size (fs_device))
+  for (i = 0; i < n; i++)
   {
-    int next = cache_allocate (sector + 1);
+    run[i]->loaded = 1;
+    run[i]->prefetched = 1;
+    rwlock_release (&run[i]->lock);
+  }
+  stats.read_ahead_cnt += n;
+}
 
-    if (!cache[next].loaded)
+/* Brings the CNT sectors starting at SECTOR, of class CLASS, into
+   the cache without pinning them.  Each run of adjacent sectors
+   that are not cached is read with a single disk request of up to
+   BLOCK_MAX_MULTIPLE sectors.  Sectors already in the cache, or
+   being loaded by another thread, are left alone. */
+void
+cache_read_range (block_sector_t sector, size_t cnt, enum cache_class class)
+{
+  struct cache_entry *run[BLOCK_MAX_MULTIPLE];
+  size_t run_max, n = 0;
+
+  /* Leave most of the cache unlocked for eviction. */
+  run_max = cache_cnt / 4;
+  if (run_max > BLOCK_MAX_MULTIPLE)
+    run_max = BLOCK_MAX_MULTIPLE;
+
+  for (; cnt > 0; sector++, cnt--)
+  {
+    struct cache_bucket *b = bucket_of (sector);
+    struct cache_entry *c;
+
+    timed_acquire (&b->lock);
+    c = bucket_find (b, sector);
+    lock_release (&b->lock);
+
+    c = c == NULL ? cache_insert (sector, class) : NULL;
+    if (c == NULL)
     {
-      lock_acquire (&cache_lock);
-      //put into queue
-      struct queue_entry *new = malloc (sizeof (struct queue_entry));
-      new->index = next;
+      cache_load_run (run, n);
+      n = 0;
+      continue;
+    }
 
-      if (list_empty (&read_queue))
-      {
-        list_push_back (&read_queue, &new->elem);
-        sema_up (&read_sema);
-      }
-      else
-        list_push_back (&read_queue, &new->elem);
-      lock_release (&cache_lock);
+    run[n++] = c;
+    if (n == run_max)
+    {
+      cache_load_run (run, n);
+      n = 0;
     }
+  }
+  cache_load_run (run, n);
+}
+
+/* Asks the read-ahead thread to bring the CNT sectors starting at
+   SECTOR, of class CLASS, into the cache.
+   Never blocks on I/O; the request is dropped if too many are
+   already pending. */
+void
+cache_read_ahead (block_sector_t sector, size_t cnt, enum cache_class class)
+{
+  bool queued = false;
+
+  if (sector >= block_size (fs_device))
+    return;
+  if (cnt > block_size (fs_device) - sector)
+    cnt = block_size (fs_device) - sector;
 
-    lock_release (&cache[next].lock);
+  lock_acquire (&read_lock);
+  if (read_head - read_tail < READ_AHEAD_SLOTS)
+  {
+    read_ring[read_head % READ_AHEAD_SLOTS].sector = sector;
+    read_ring[read_head % READ_AHEAD_SLOTS].cnt = cnt;
+    read_ring[read_head % READ_AHEAD_SLOTS].class = class;
+    read_head++;
+    queued = true;
   }
+  lock_release (&read_lock);
+
+  if (queued)
+    sema_up (&read_sema);
 }
 
 void
 cache_done (void)
 {
-  lock_acquire(&cache_lock);
-  for (int i = 0; i < 64; i++)
+  cache_flush (SIZE_MAX);
+}
+
+/* Copies the current statistics into *OUT. */
+void
+cache_get_stats (struct cache_stats *out)
+{
+  *out = stats;
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  static const char *class_names[CACHE_CLASS_CNT] =
+    {"data", "inode", "indirect", "directory", "free map"};
+  int i;
+
+  if (cache == NULL)
+    return;
+
+  printf ("Buffer cache: %zu sectors, %llu read ahead "
+          "(%llu used, %llu wasted), %llu lock waits (%llu ticks)\n",
+          cache_cnt, stats.read_ahead_cnt, stats.read_ahead_hit_cnt,
+          stats.read_ahead_waste_cnt, stats.lock_wait_cnt,
+          stats.lock_wait_ticks);
+  for (i = 0; i < CACHE_CLASS_CNT; i++)
   {
-    if (cache[i].dirty && cache[i].loaded)
-    {
-      block_write(fs_device, cache[i].sector, cache[i].buffer);
-      cache[i].dirty = false;
-    }
+    const struct cache_class_stats *cs = &stats.classes[i];
+    printf ("  %s: %llu hits, %llu misses, %llu evictions, "
+            "%llu write-backs\n", class_names[i], cs->hit_cnt,
+            cs->miss_cnt, cs->evict_cnt, cs->write_back_cnt);
   }
-  lock_release(&cache_lock);
+}
+
+/* A dirty sector picked for write-back. */
+struct flush_item
+  {
+    struct cache_entry *entry;
+    block_sector_t sector;
+  };
 
+static int
+flush_item_compare (const void *a_, const void *b_)
+{
+  const struct flush_item *a = a_;
+  const struct flush_item *b = b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
 }
 
+/* Returns true if ITEM's entry, which must be locked, still holds
+   ITEM's sector and is dirty. */
+static bool
+flush_item_dirty (const struct flush_item *item)
+{
+  struct cache_entry *c = item->entry;
 
+  return c->valid && c->sector == item->sector && c->dirty;
+}
 
-void
-read_ahead (void *aux UNUSED)
+/* Writes the N entries in RUN, which hold consecutive sectors and
+   are locked, back to disk with one request, marks them clean, and
+   releases them. */
+static void
+cache_write_run (struct flush_item *run, size_t n)
 {
-  while (true)
+  void *buffers[WRITE_BACK_BATCH];
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    buffers[i] = run[i].entry->buffer;
+  block_write_multiple (fs_device, run[0].sector, n, buffers);
+
+  for (i = 0; i < n; i++)
   {
-    if (list_empty (&read_queue))
-      sema_down (&read_sema);
+    struct cache_entry *c = run[i].entry;
+
+    cache_mark_clean (c);
+    stats.classes[c->class].write_back_cnt++;
+    rwlock_release (&c->lock);
+  }
+}
 
+/* Writes back up to MAX_CNT dirty sectors, oldest first.  Each batch
+   is sorted by sector number, and each run of adjacent sectors goes
+   out to the disk in a single request. */
+static void
+cache_flush (size_t max_cnt)
+{
+  struct flush_item batch[WRITE_BACK_BATCH];
 
-    while (!list_empty (&read_queue))
+  while (max_cnt > 0)
+  {
+    struct list_elem *e;
+    size_t n = 0;
+
+    lock_acquire (&dirty_lock);
+    for (e = list_begin (&dirty_list);
+         e != list_end (&dirty_list) && n < WRITE_BACK_BATCH && n < max_cnt;
+         e = list_next (e))
     {
-      lock_acquire (&cache_lock);
-      struct list_elem *e = list_pop_front (&read_queue);
-      lock_release (&cache_lock);
+      batch[n].entry = list_entry (e, struct cache_entry, dirty_elem);
+      batch[n].sector = batch[n].entry->sector;
+      n++;
+    }
+    lock_release (&dirty_lock);
 
-      struct queue_entry *queue_entry = list_entry (e, struct queue_entry, elem);
-      int index = queue_entry->index;
+    if (n == 0)
+      break;
+    max_cnt -= n;
 
-      lock_acquire (&cache[index].lock);
-      if (!cache[index].loaded)
-        cache_load (&cache[index]);
-      lock_release (&cache[index].lock);
+    qsort (batch, n, sizeof *batch, flush_item_compare);
+    for (size_t i = 0; i < n; )
+    {
+      size_t start = i;
+
+      /* The entry may have been written back by eviction in the
+         meantime.  Writing it back only reads the buffer, so readers
+         of the sector need not wait. */
+      timed_acquire_entry (batch[i].entry, CACHE_SHARED);
+      if (!flush_item_dirty (&batch[i]))
+      {
+        rwlock_release (&batch[i].entry->lock);
+        i++;
+        continue;
+      }
 
-      free (queue_entry);
+      /* Extend the run over the following sectors, but never wait
+         for one while holding the others. */
+      for (i++; i < n && batch[i].sector == batch[i - 1].sector + 1; i++)
+      {
+        if (!rwlock_try_acquire_read (&batch[i].entry->lock))
+          break;
+        if (!flush_item_dirty (&batch[i]))
+        {
+          rwlock_release (&batch[i].entry->lock);
+          break;
+        }
+      }
 
-      // block_read (fs_device, cache[index].sector, &cache[index].buffer);
-      // lock_release (&cache[index].lock);
+      cache_write_run (batch + start, i - start);
     }
   }
 }
 
+void
+read_ahead (void *aux UNUSED)
+{
+  while (true)
+  {
+    block_sector_t sector;
+    size_t cnt;
+    enum cache_class class;
+
+    sema_down (&read_sema);
+    lock_acquire (&read_lock);
+    sector = read_ring[read_tail % READ_AHEAD_SLOTS].sector;
+    cnt = read_ring[read_tail % READ_AHEAD_SLOTS].cnt;
+    class = read_ring[read_tail % READ_AHEAD_SLOTS].class;
+    read_tail++;
+    lock_release (&read_lock);
+
+    cache_read_range (sector, cnt, class);
+  }
+}
+
 void
 write_back (void *aux UNUSED)
 {
+  int64_t last_flush = timer_ticks ();
+
   while (1)
   {
-    thread_sleep (1000);
-    for (int i = 0; i < 64; i++)
+    timer_sleep (WRITE_BACK_POLL);
+
+    if (write_back_interval > 0
+        && timer_elapsed (last_flush) >= write_back_interval * TIMER_FREQ / 1000)
     {
-      lock_acquire (&cache[i].lock);
-      if (cache[i].dirty && cache[i].valid)
-      {
-        block_write (fs_device, cache[i].sector, cache[i].buffer);
-        cache[i].dirty = 0;
-      }
-      lock_release (&cache[i].lock);
+      /* Data whose sectors are not allocated yet has to be placed
+         before it can be written back. */
+      inode_place_all ();
+      cache_flush (dirty_cnt);
+      last_flush = timer_ticks ();
     }
+    else if (cache_over_dirty_ratio ())
+      cache_flush (dirty_cnt);
   }
 }
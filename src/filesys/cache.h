@@ -1,4 +1,45 @@
-void cache_read_at (block_sector_t, void *, int, int);
-void cache_write_at (block_sector_t, const void *, int, int);
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <cache-stats.h>
+#include "devices/block.h"
+
+struct cache_entry;
+
+/* Placeholder sector numbers for data not yet given a disk sector
+   start here, far above any real sector. */
+#define CACHE_DELAYED 0x80000000
+
+/* How cache_get locks a sector. */
+enum cache_mode
+  {
+    CACHE_SHARED,               /* Read only. */
+    CACHE_EXCLUSIVE             /* May modify the buffer. */
+  };
+
+struct cache_entry *cache_get (block_sector_t, enum cache_class,
+                               enum cache_mode);
+struct cache_entry *cache_get_zeroed (block_sector_t, enum cache_class);
+struct cache_entry *cache_get_delayed (enum cache_class, block_sector_t *);
+void cache_place (block_sector_t delayed, block_sector_t sector);
+void cache_discard (block_sector_t);
+void *cache_buffer (struct cache_entry *);
+void cache_put (struct cache_entry *, bool dirty);
+void cache_read_at (block_sector_t, enum cache_class, void *, int, int);
+void cache_write_at (block_sector_t, enum cache_class, const void *, int, int);
+void cache_read_range (block_sector_t, size_t cnt, enum cache_class);
+void cache_read_ahead (block_sector_t, size_t cnt, enum cache_class);
+void cache_configure (size_t sectors);
+void cache_configure_max (size_t sectors);
+void cache_configure_write_back (int ms);
+void cache_configure_dirty_ratio (int percent);
+bool cache_configure_policy (const char *name);
 void cache_init (void);
+bool cache_shrink (void);
 void cache_done (void);
+void cache_get_stats (struct cache_stats *);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
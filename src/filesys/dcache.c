@@ -0,0 +1,175 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Name cache.
+
+   Maps a directory's inode sector and a name in it to the inode
+   sector the name refers to, so that resolving a path does not
+   search each directory on it.  A negative entry, with sector 0,
+   records that the name does not exist.  The directory code
+   keeps the cache consistent by updating it under a directory's
+   lock whenever it adds or removes a name. */
+
+/* Maximum number of cached names. */
+#define DCACHE_SIZE 512
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    const char *name;                   /* Name in DIR. */
+    block_sector_t sector;              /* Inode sector, 0 if none. */
+  };
+
+static struct hash dentries;            /* Cached names. */
+static struct list lru;                 /* Least recently used first. */
+static size_t dentry_cnt;               /* Number of cached names. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  dentry_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  key.dir = dir;
+  key.name = name;
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Drops D from the cache and frees it. */
+static void
+drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  dentry_cnt--;
+  free (d);
+}
+
+/* Looks up NAME in directory DIR in the cache.  If it is cached,
+   stores the sector of its inode, or 0 if the name is known not
+   to exist, into *SECTORP and returns true.  Otherwise returns
+   false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *sectorp = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR refers to the inode in
+   SECTOR, or that it does not exist if SECTOR is 0.  Evicts the
+   least recently used name if the cache is full.  The cache is
+   only a hint, so running out of memory is not an error. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+  size_t len = strlen (name);
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      d->sector = sector;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  else
+    {
+      if (dentry_cnt >= DCACHE_SIZE)
+        drop (list_entry (list_front (&lru), struct dentry, lru_elem));
+
+      d = malloc (sizeof *d + len + 1);
+      if (d != NULL)
+        {
+          char *copy = (char *) (d + 1);
+
+          memcpy (copy, name, len + 1);
+          d->dir = dir;
+          d->name = copy;
+          d->sector = sector;
+          hash_insert (&dentries, &d->hash_elem);
+          list_push_back (&lru, &d->lru_elem);
+          dentry_cnt++;
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for directory DIR, which is being
+   deleted, so that a directory created later in the same sector
+   does not inherit them. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+
+      next = list_next (e);
+      if (d->dir == dir)
+        drop (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,31 +1,330 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory is a hash table of its entries, keyed by name and
+   grown a bucket at a time by linear hashing.  The first block
+   of the directory holds a header.  Each bucket owns the next
+   BUCKET_BLOCKS blocks, used from the first on, so the blocks a
+   bucket does not use are holes that take no disk space.
+   Entries are variable-length records packed at the start of
+   each block. */
+#define DIR_MAGIC 0x44495249            /* "DIRI". */
+#define BUCKET_BLOCKS 8                 /* Blocks owned by a bucket. */
+#define BUCKET_LOAD 16                  /* Average entries per bucket
+                                           before a bucket is split. */
+
+/* Directory header, in the directory's first block. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_MAGIC. */
+    uint32_t level;                     /* Buckets split 2**LEVEL ways. */
+    uint32_t split;                     /* Next bucket to split. */
+  };
+
+/* A directory entry on disk. */
+struct dir_record
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    uint8_t isdir;                      /* Names a directory? */
+    uint8_t name_len;                   /* Length of NAME. */
+    char name[];                        /* File name, not null
+                                           terminated. */
+  };
+
+/* Bytes taken by a record for a name of LEN characters, padded to
+   keep the next record aligned. */
+#define RECORD_SIZE(LEN) \
+        ROUND_UP (offsetof (struct dir_record, name) + (LEN), 4)
+
+/* What a directory keeps in memory while its inode is open, so
+   that adding an entry need not read the header, search its
+   bucket for room, or, when the name cache already knows the
+   name is missing, search its bucket for the name.  Records are
+   only ever appended to the last block a bucket uses, since
+   removals pack the blocks before it full. */
+struct dir_hints
+  {
+    struct dir_header h;                /* Copy of the header. */
+    size_t capacity;                    /* Number of elements in LAST. */
+    uint8_t last[];                     /* Last block each bucket uses,
+                                           or LAST_UNKNOWN. */
+  };
+#define LAST_UNKNOWN UINT8_MAX
+
+/* A block of a bucket. */
+struct dir_block
+  {
+    uint16_t used;                      /* Bytes of RECORDS in use. */
+    uint16_t more;                      /* Bucket goes on in next block? */
+    uint8_t records[BLOCK_SECTOR_SIZE - 2 * sizeof (uint16_t)];
+  };
+
+/* Returns the number of buckets in a directory with header H. */
+static size_t
+bucket_cnt (const struct dir_header *h)
+{
+  return ((size_t) 1 << h->level) + h->split;
+}
+
+/* Returns true if a directory with header H that holds ENTRY_CNT
+   entries is loaded enough that a bucket should be split. */
+static bool
+overloaded (const struct dir_header *h, size_t entry_cnt)
+{
+  return entry_cnt > bucket_cnt (h) * BUCKET_LOAD;
+}
+
+/* Returns the bucket that holds NAME in a directory with header
+   H.  Buckets before the split point have already been split,
+   so they use one more bit of the hash. */
+static size_t
+name_bucket (const struct dir_header *h, const char *name)
+{
+  unsigned hash = hash_string (name);
+  size_t bucket = hash & ((1u << h->level) - 1);
+
+  if (bucket < h->split)
+    bucket = hash & ((2u << h->level) - 1);
+  return bucket;
+}
+
+/* Returns the byte offset of block K of BUCKET. */
+static off_t
+block_ofs (size_t bucket, size_t k)
+{
+  return (1 + bucket * BUCKET_BLOCKS + k) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the record at byte OFS of block B's records. */
+static struct dir_record *
+record_at (const struct dir_block *b, size_t ofs)
+{
+  return (struct dir_record *) (b->records + ofs);
+}
+
+/* Returns the number of bytes record R takes. */
+static size_t
+record_size (const struct dir_record *r)
+{
+  return RECORD_SIZE (r->name_len);
+}
+
+/* Returns true if record R is for the LEN-character NAME. */
+static bool
+record_is (const struct dir_record *r, const char *name, size_t len)
+{
+  return r->name_len == len && !memcmp (r->name, name, len);
+}
+
+/* Appends a record for the LEN-character NAME, naming the inode
+   in SECTOR, to block B.  Returns false if it does not fit. */
+static bool
+block_append (struct dir_block *b, const char *name, size_t len,
+              block_sector_t sector, bool isdir)
+{
+  size_t size = RECORD_SIZE (len);
+  struct dir_record *r;
+
+  if (b->used + size > sizeof b->records)
+    return false;
+  r = record_at (b, b->used);
+  memset (r, 0, size);
+  r->inode_sector = sector;
+  r->isdir = isdir;
+  r->name_len = len;
+  memcpy (r->name, name, len);
+  b->used += size;
+  return true;
+}
+
+/* Deletes the record at byte OFS of block B's records, moving the
+   records after it down to close the gap. */
+static void
+block_delete (struct dir_block *b, size_t ofs)
+{
+  size_t size = record_size (record_at (b, ofs));
+
+  memmove (b->records + ofs, b->records + ofs + size,
+           b->used - ofs - size);
+  b->used -= size;
+}
+
+/* Appends record R to the bucket being built in IMAGE, whose last
+   block is *K, starting a new block if need be.  Returns false
+   if the bucket has no room left. */
+static bool
+image_append (struct dir_block image[], size_t *k,
+              const struct dir_record *r)
+{
+  if (block_append (&image[*k], r->name, r->name_len, r->inode_sector,
+                    r->isdir))
+    return true;
+  if (*k + 1 == BUCKET_BLOCKS)
+    return false;
+  image[(*k)++].more = true;
+  return block_append (&image[*k], r->name, r->name_len, r->inode_sector,
+                       r->isdir);
+}
+
+/* Reads DIR's header into *H.  Returns false if DIR does not
+   have a valid header. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == DIR_MAGIC);
+}
+
+/* Writes *H as DIR's header.  Returns true if successful. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h)
+{
+  return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Reads DIR's header into *H, from DIR's hints if it has them.
+   Returns false if DIR does not have a valid header. */
+static bool
+get_header (const struct dir *dir, struct dir_header *h)
+{
+  const struct dir_hints *hints = inode_dir_hints (dir->inode);
+
+  if (hints == NULL)
+    return read_header (dir, h);
+  *h = hints->h;
+  return true;
+}
+
+/* Makes DIR's hints, whose header is *H, hold the last blocks of
+   at least CNT buckets, those not yet known as LAST_UNKNOWN.
+   Returns the hints, or a null pointer if memory is short. */
+static struct dir_hints *
+reserve_hints (struct dir *dir, const struct dir_header *h, size_t cnt)
+{
+  struct dir_hints *hints = inode_dir_hints (dir->inode);
+  size_t old_capacity = hints != NULL ? hints->capacity : 0;
+  struct dir_header new_h = *h;
+  size_t capacity;
+
+  if (cnt <= old_capacity)
+    return hints;
+  capacity = cnt > 2 * old_capacity ? cnt : 2 * old_capacity;
+  hints = realloc (hints, sizeof *hints + capacity);
+  if (hints == NULL)
+    return NULL;
+  hints->h = new_h;
+  hints->capacity = capacity;
+  memset (hints->last + old_capacity, LAST_UNKNOWN, capacity - old_capacity);
+  inode_set_dir_hints (dir->inode, hints);
+  return hints;
+}
+
+/* Returns DIR's hints, reading them in from its header if it does
+   not have them yet.  Returns a null pointer if DIR does not have
+   a valid header or memory is short.  The caller must hold DIR's
+   directory lock. */
+static struct dir_hints *
+get_hints (struct dir *dir)
+{
+  struct dir_hints *hints = inode_dir_hints (dir->inode);
+  struct dir_header h;
+
+  if (hints == NULL && read_header (dir, &h))
+    hints = reserve_hints (dir, &h, bucket_cnt (&h));
+  return hints;
+}
+
+/* Reads block K of BUCKET in DIR into *B.  A block that was never
+   written, even one past end of file, reads as empty. */
+static void
+read_block (const struct dir *dir, size_t bucket, size_t k,
+            struct dir_block *b)
+{
+  memset (b, 0, sizeof *b);
+  inode_read_at (dir->inode, b, sizeof *b, block_ofs (bucket, k));
+}
+
+/* Writes *B as block K of BUCKET in DIR.  Returns true if
+   successful. */
+static bool
+write_block (struct dir *dir, size_t bucket, size_t k,
+             const struct dir_block *b)
+{
+  return (inode_write_at (dir->inode, b, sizeof *b, block_ofs (bucket, k))
+          == sizeof *b);
+}
+
+/* Reads the blocks BUCKET uses in DIR into BLOCKS, which must
+   have room for BUCKET_BLOCKS, and returns how many there are. */
+static size_t
+read_bucket (const struct dir *dir, size_t bucket, struct dir_block blocks[])
+{
+  size_t cnt = 0;
+
+  while (cnt < BUCKET_BLOCKS)
+    {
+      read_block (dir, bucket, cnt, &blocks[cnt]);
+      if (!blocks[cnt++].more)
+        break;
+    }
+  return cnt;
+}
+
+/* Writes the first CNT blocks of BLOCKS as BUCKET in DIR.
+   Returns true if successful. */
+static bool
+write_bucket (struct dir *dir, size_t bucket, const struct dir_block blocks[],
+              size_t cnt)
+{
+  size_t k;
+
+  for (k = 0; k < cnt; k++)
+    if (!write_block (dir, bucket, k, &blocks[k]))
+      return false;
+  return true;
+}
+
+/* Creates a directory in the given SECTOR, with enough buckets
+   to hold ENTRY_CNT entries without splitting.  Returns true if
+   successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt, struct dir *prevdir)
 {
-  bool success = inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
+  bool success = inode_create (sector, 0, true);
   if (success)
   {
     struct dir *dir = dir_open (inode_open (sector));
-    dir_add (dir, ".", sector);
+    struct dir_header h;
+
+    /* Forget names cached for whatever used SECTOR before. */
+    dcache_invalidate_dir (sector);
+
+    h.magic = DIR_MAGIC;
+    h.level = 0;
+    h.split = 0;
+    while (overloaded (&h, entry_cnt))
+      h.level++;
+    success = write_header (dir, &h);
+
+    dir_add (dir, ".", sector, true);
 
     if (sector != ROOT_DIR_SECTOR)
     {
       block_sector_t prev_sector = inode_get_inumber (prevdir->inode);
-      dir_add (dir, "..", prev_sector);
+      dir_add (dir, "..", prev_sector, true);
     }
     else
     {
-      dir_add (dir, "..", sector);
+      dir_add (dir, "..", sector, true);
     }
 
     dir_close (dir);
@@ -88,65 +387,277 @@ dir_get_inode (struct dir *dir)
 }
 
 /* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   If successful, returns true, sets *SECTORP to the sector of
+   its inode if SECTORP is non-null, and sets *BUCKETP to the
+   bucket that holds it if BUCKETP is non-null.
+   otherwise, returns false and ignores SECTORP and BUCKETP.
+   Only the blocks of NAME's bucket are read. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        block_sector_t *sectorp, size_t *bucketp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  size_t len = strlen (name);
+  struct dir_header h;
+  struct dir_block *b;
+  size_t bucket, k, ofs;
+  bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  if (!get_header (dir, &h))
+    return false;
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  bucket = name_bucket (&h, name);
+  for (k = 0; k < BUCKET_BLOCKS && !success; k++)
+    {
+      read_block (dir, bucket, k, b);
+      for (ofs = 0; ofs < b->used; ofs += record_size (record_at (b, ofs)))
+        if (record_is (record_at (b, ofs), name, len))
+          {
+            if (sectorp != NULL)
+              *sectorp = record_at (b, ofs)->inode_sector;
+            if (bucketp != NULL)
+              *bucketp = bucket;
+            success = true;
+            break;
+          }
+      if (!b->more)
+        break;
+    }
+  free (b);
+  return success;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names found, or found missing, are remembered in the name
+   cache, so that looking them up again does not read DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
-  struct dir_entry e;
+  block_sector_t dir_sector, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_dir_lock (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      if (!lookup (dir, name, &sector, NULL))
+        sector = 0;
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_dir_unlock (dir->inode);
 
   return *inode != NULL;
 }
 
+/* Stores a record for NAME, naming the inode in SECTOR, in the
+   last block of BUCKET in DIR, or in a block after it if that one
+   is full, and records the block in HINTS.  If SEARCH is true,
+   first checks that NAME is not in the bucket, setting *EXISTSP
+   if it is.  The bucket is read at most once, and only its last
+   block is read if SEARCH is false and HINTS know which it is.
+   Returns false if NAME is there, the bucket is full, or a disk
+   error occurs. */
+static bool
+bucket_insert (struct dir *dir, struct dir_hints *hints, size_t bucket,
+               const char *name, block_sector_t sector, bool isdir,
+               bool search, bool *existsp)
+{
+  size_t len = strlen (name);
+  size_t last = hints->last[bucket];
+  struct dir_block *b, *next;
+  size_t ofs;
+  bool success = false;
+
+  *existsp = false;
+  b = calloc (2, sizeof *b);
+  if (b == NULL)
+    return false;
+  next = b + 1;
+
+  if (search || last == LAST_UNKNOWN)
+    for (last = 0; ; last++)
+      {
+        read_block (dir, bucket, last, b);
+        if (search)
+          for (ofs = 0; ofs < b->used; ofs += record_size (record_at (b, ofs)))
+            if (record_is (record_at (b, ofs), name, len))
+              {
+                *existsp = true;
+                goto done;
+              }
+        if (!b->more || last + 1 == BUCKET_BLOCKS)
+          break;
+      }
+  else
+    read_block (dir, bucket, last, b);
+  hints->last[bucket] = last;
+
+  if (block_append (b, name, len, sector, isdir))
+    success = write_block (dir, bucket, last, b);
+  else if (last + 1 < BUCKET_BLOCKS)
+    {
+      /* Start the bucket's next block, then link it in. */
+      block_append (next, name, len, sector, isdir);
+      b->more = true;
+      success = (write_block (dir, bucket, last + 1, next)
+                 && write_block (dir, bucket, last, b));
+      if (success)
+        hints->last[bucket] = last + 1;
+    }
+
+ done:
+  free (b);
+  return success;
+}
+
+/* Deletes the record for NAME from BUCKET in DIR.  The bucket's
+   records are then repacked from its first block on, so that
+   the blocks a bucket uses stay few and full, and the bucket's
+   last block is recorded in HINTS.  Returns true if
+   successful. */
+static bool
+bucket_delete (struct dir *dir, struct dir_hints *hints, size_t bucket,
+               const char *name)
+{
+  size_t len = strlen (name);
+  struct dir_block *blocks, *image;
+  size_t cnt, image_k = 0, k, ofs;
+  bool found = false, packed = true, success;
+
+  blocks = calloc (2 * BUCKET_BLOCKS, sizeof *blocks);
+  if (blocks == NULL)
+    return false;
+  image = blocks + BUCKET_BLOCKS;
+
+  cnt = read_bucket (dir, bucket, blocks);
+  for (k = 0; k < cnt; k++)
+    for (ofs = 0; ofs < blocks[k].used; )
+      {
+        struct dir_record *r = record_at (&blocks[k], ofs);
+        if (!found && record_is (r, name, len))
+          {
+            block_delete (&blocks[k], ofs);
+            found = true;
+            continue;
+          }
+        packed = packed && image_append (image, &image_k, r);
+        ofs += record_size (r);
+      }
+
+  /* Packing the records afresh can take more blocks than they had
+     in the unlikely case that they fit only in their old order.
+     Then the gap left in place will do. */
+  if (!found)
+    success = false;
+  else if (packed)
+    {
+      success = write_bucket (dir, bucket, image,
+                              cnt > image_k ? cnt : image_k + 1);
+      hints->last[bucket] = success ? image_k : LAST_UNKNOWN;
+    }
+  else
+    success = write_bucket (dir, bucket, blocks, cnt);
+  free (blocks);
+  return success;
+}
+
+/* Splits the next bucket in turn of DIR: the entries that hash
+   to the bucket added at the end of the table move there and the
+   rest are packed together.  Updates DIR's header and hints,
+   which may move in memory.  Returns true if successful. */
+static bool
+split_bucket (struct dir *dir)
+{
+  struct dir_hints *hints = inode_dir_hints (dir->inode);
+  struct dir_header *h;
+  size_t old_bucket, new_bucket;
+  unsigned mask;
+  struct dir_block *old, *kept, *moved;
+  size_t old_cnt, kept_k = 0, moved_k = 0, k, ofs;
+  bool success = true;
+
+  hints = reserve_hints (dir, &hints->h, bucket_cnt (&hints->h) + 1);
+  if (hints == NULL)
+    return false;
+  h = &hints->h;
+  old_bucket = h->split;
+  new_bucket = old_bucket + ((size_t) 1 << h->level);
+  mask = (2u << h->level) - 1;
+
+  old = calloc (3 * BUCKET_BLOCKS, sizeof *old);
+  if (old == NULL)
+    return false;
+  kept = old + BUCKET_BLOCKS;
+  moved = kept + BUCKET_BLOCKS;
+
+  /* Sort the bucket's entries between the two buckets. */
+  old_cnt = read_bucket (dir, old_bucket, old);
+  for (k = 0; k < old_cnt && success; k++)
+    for (ofs = 0; ofs < old[k].used && success; )
+      {
+        const struct dir_record *r = record_at (&old[k], ofs);
+
+        /* Hashes the same as hash_string() on the name. */
+        if ((hash_bytes (r->name, r->name_len) & mask) == old_bucket)
+          success = image_append (kept, &kept_k, r);
+        else
+          success = image_append (moved, &moved_k, r);
+        ofs += record_size (r);
+      }
+
+  /* Fill the new bucket, publish it, then rewrite the old bucket
+     in full so that moved entries disappear from it. */
+  success = success && write_bucket (dir, new_bucket, moved, moved_k + 1);
+  if (success)
+    {
+      struct dir_header new_h = *h;
+
+      if (++new_h.split == (1u << new_h.level))
+        {
+          new_h.level++;
+          new_h.split = 0;
+        }
+      success = write_header (dir, &new_h);
+      if (success)
+        {
+          *h = new_h;
+          hints->last[new_bucket] = moved_k;
+        }
+    }
+  success = success && write_bucket (dir, old_bucket, kept,
+                                     old_cnt > kept_k ? old_cnt : kept_k + 1);
+  hints->last[old_bucket] = success ? kept_k : LAST_UNKNOWN;
+
+  free (old);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and ISDIR tells whether it is a directory.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
+         bool isdir)
 {
-  struct dir_entry e;
-  off_t ofs;
+  block_sector_t dir_sector, sector;
+  struct dir_hints *hints;
+  size_t tries;
+  bool search, exists;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -156,33 +667,45 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_dir_lock (dir->inode);
+  hints = get_hints (dir);
+  if (hints == NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Check that NAME is not in use.  A name the name cache knows
+     about need not be searched for, and creating a file usually
+     follows a lookup that found it missing. */
+  search = !dcache_lookup (dir_sector, name, &sector);
+  if (!search && sector != 0)
+    goto done;
 
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
+  /* Store the entry in NAME's bucket.  If the bucket is full,
+     split buckets in turn until it has room, giving up once every
+     bucket has been split. */
+  for (tries = bucket_cnt (&hints->h);
+       !bucket_insert (dir, hints, name_bucket (&hints->h, name), name,
+                       inode_sector, isdir, search, &exists);
+       tries--)
+    {
+      if (exists || tries == 0 || !split_bucket (dir))
+        goto done;
+      hints = inode_dir_hints (dir->inode);
+      search = false;
+    }
 
   if (strcmp (name, ".") != 0 && strcmp (name, "..") != 0)
     inode_entrycnt_inc (dir->inode);
+  dcache_insert (dir_sector, name, inode_sector);
 
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Split a bucket for each few entries added, to keep buckets
+     to about one block. */
+  if (overloaded (&hints->h, inode_entrycnt (dir->inode)))
+    split_bucket (dir);
+  success = true;
 
  done:
+  inode_dir_unlock (dir->inode);
   return success;
 }
 
@@ -192,26 +715,29 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name)
 {
-  struct dir_entry e;
   struct inode *inode = NULL;
+  struct dir_hints *hints;
+  block_sector_t sector;
+  size_t bucket;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_dir_lock (dir->inode);
   if (!strcmp (name, ".") || !strcmp (name, ".."))
     goto done;
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  hints = get_hints (dir);
+  if (hints == NULL || !lookup (dir, name, &sector, &bucket))
     goto done;
 
-  if (e.inode_sector == ROOT_DIR_SECTOR)
+  if (sector == ROOT_DIR_SECTOR)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (sector);
 
   if (inode == NULL)
     goto done;
@@ -220,37 +746,99 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
 
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+  if (!bucket_delete (dir, hints, bucket, name))
     goto done;
 
-  /* Remove inode. */
+  /* Remove inode, and cache that NAME is gone. */
   inode_remove (inode);
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
+  if (inode_isdir (inode))
+    dcache_invalidate_dir (sector);
   success = true;
 
  done:
   inode_close (inode);
   if (success)
     inode_entrycnt_dec (dir->inode);
+  inode_dir_unlock (dir->inode);
   return success;
 }
 
-/* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+/* Reads the next directory entry in DIR into *EP.  Returns true
+   if successful, false if the directory contains no more
+   entries.  Entries come in bucket order, and DIR's position
+   skips the blocks each bucket leaves unused.  Removing entries
+   packs the ones after them closer, so a position saved across
+   a removal may pass over an entry. */
 bool
-dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+dir_readdir_entry (struct dir *dir, struct dir_entry *ep)
 {
-  struct dir_entry e;
+  const off_t hdr = offsetof (struct dir_block, records);
+  struct dir_header h;
+  struct dir_block *b;
+  bool success = false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  inode_dir_lock (dir->inode);
+  if (get_header (dir, &h))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      if (dir->pos < block_ofs (0, 0))
+        dir->pos = block_ofs (0, 0);
+      while (!success)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          off_t rel = dir->pos - block_ofs (0, 0);
+          size_t bucket = rel / (BUCKET_BLOCKS * BLOCK_SECTOR_SIZE);
+          size_t k = rel / BLOCK_SECTOR_SIZE % BUCKET_BLOCKS;
+          off_t want = rel % BLOCK_SECTOR_SIZE - hdr;
+          size_t ofs;
+
+          if (bucket >= bucket_cnt (&h))
+            break;
+
+          /* Find the first record at or after the position. */
+          read_block (dir, bucket, k, b);
+          for (ofs = 0; ofs < b->used && (off_t) ofs < want; )
+            ofs += record_size (record_at (b, ofs));
+          if (ofs < b->used)
+            {
+              const struct dir_record *r = record_at (b, ofs);
+
+              ep->inode_sector = r->inode_sector;
+              ep->isdir = r->isdir;
+              memcpy (ep->name, r->name, r->name_len);
+              ep->name[r->name_len] = '\0';
+              dir->pos = (block_ofs (bucket, k) + hdr + ofs
+                          + record_size (r));
+              success = true;
+            }
+          else if (b->more && k + 1 < BUCKET_BLOCKS)
+            dir->pos = block_ofs (bucket, k + 1);
+          else
+            dir->pos = block_ofs (bucket + 1, 0);
         }
     }
-  return false;
+  inode_dir_unlock (dir->inode);
+  free (b);
+  return success;
+}
+
+/* Reads the next directory entry in DIR and stores the name in
+   NAME.  Returns true if successful, false if the directory
+   contains no more entries. */
+bool
+dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  struct dir_entry *e = malloc (sizeof *e);
+  bool success;
+
+  if (e == NULL)
+    return false;
+  success = dir_readdir_entry (dir, e);
+  if (success)
+    strlcpy (name, e->name, NAME_MAX + 1);
+  free (e);
+  return success;
 }
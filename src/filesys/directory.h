@@ -6,11 +6,10 @@
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
-/* Maximum length of a file name component.
-   This is the traditional UNIX maximum length.
-   After directories are implemented, this maximum length may be
-   retained, but much longer full path names must be allowed. */
-#define NAME_MAX 14
+/* Maximum length of a file name component.  Directory entries
+   are variable-length, so long names only cost the space they
+   use. */
+#define NAME_MAX 255
 
 struct inode;
 
@@ -21,12 +20,12 @@ struct dir
     off_t pos;                          /* Current position. */
   };
 
-/* A single directory entry. */
+/* A single directory entry, as returned by dir_readdir_entry(). */
 struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    bool isdir;                         /* Names a directory? */
   };
 
 /* Opening and closing directories. */
@@ -39,8 +38,9 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, block_sector_t);
+bool dir_add (struct dir *, const char *name, block_sector_t, bool isdir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+bool dir_readdir_entry (struct dir *, struct dir_entry *);
 
 #endif /* filesys/directory.h */
@@ -7,6 +7,7 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "threads/thread.h"
 
 /* Partition that contains the file system. */
@@ -15,7 +16,8 @@ struct block *fs_device;
 static void do_format (void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system with the inode
+   layout chosen by inode_configure_format(). */
 void
 filesys_init (bool format)
 {
@@ -26,9 +28,12 @@ filesys_init (bool format)
   inode_init ();
   free_map_init ();
   cache_init ();
+  dcache_init ();
 
   if (format)
     do_format ();
+  else
+    inode_adopt_format (ROOT_DIR_SECTOR);
 
   free_map_open ();
 
@@ -40,8 +45,9 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  cache_done ();
+  inode_done ();
   free_map_close ();
+  cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -54,11 +60,13 @@ filesys_create (const char *name, off_t initial_size, struct dir *dir)
   block_sector_t inode_sector = 0;
 
   bool success = (dir != NULL
-                  && free_map_allocate (&inode_sector)
+                  && free_map_allocate (1, inode_get_inumber
+                                             (dir_get_inode (dir)),
+                                        &inode_sector)
                   && inode_create (inode_sector, initial_size, false)
-                  && dir_add (dir, name, inode_sector));
+                  && dir_add (dir, name, inode_sector, false));
   if (!success && inode_sector != 0)
-    free_map_release (inode_sector);
+    free_map_release (inode_sector, 1);
   //dir_close (dir);
 
   return success;
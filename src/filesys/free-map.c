@@ -1,13 +1,39 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Free map bits held by one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that differ from FREE_MAP, one bit
+   each.  Changes are written back by free_map_flush(). */
+static struct bitmap *dirty_map;
+
+/* Free sectors, and how many of them are promised to data whose
+   allocation is delayed.  Other allocations may not dip into the
+   reserved ones. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/* Protects FREE_MAP, DIRTY_MAP, FREE_CNT, RESERVED_CNT and
+   CLAIM_CNT. */
+static struct lock free_map_lock;
+
+/* Reserved sectors that CLAIM_OWNER may allocate, handed to it by
+   free_map_claim().  CLAIM_LOCK lets one thread claim at a time. */
+static struct lock claim_lock;
+static struct thread *claim_owner;
+static size_t claim_cnt;
+
 /* Initializes the free map. */
 void
 free_map_init (void)
@@ -17,36 +43,235 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  lock_init (&claim_lock);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  reserved_cnt = 0;
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Sets CNT bits of the free map starting at SECTOR to VALUE and
+   marks the free map file sectors that hold them dirty. */
+static void
+set_run (block_sector_t sector, size_t cnt, bool value)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+  if (value)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+}
+
+/* Where a search for free sectors starts when the caller gives no
+   goal: just past the last allocation, so successive allocations
+   do not rescan the full start of the disk. */
+static block_sector_t next_sector;
+
+/* Returns GOAL, or NEXT_SECTOR if GOAL is 0 or off the disk. */
+static block_sector_t
+choose_goal (block_sector_t goal)
+{
+  if (goal == 0 || goal >= bitmap_size (free_map))
+    goal = next_sector < bitmap_size (free_map) ? next_sector : 0;
+  return goal;
+}
+
+/* Returns the first run of CNT free sectors at or after GOAL,
+   wrapping around to the start of the disk, or BITMAP_ERROR if
+   there is none. */
+static size_t
+scan_from (block_sector_t goal, size_t cnt)
+{
+  size_t start = bitmap_scan (free_map, goal, cnt, false);
+  if (start == BITMAP_ERROR)
+    start = bitmap_scan (free_map, 0, cnt, false);
+  return start;
+}
+
+/* Returns the number of free sectors the running thread may
+   allocate: those not reserved, plus those it has claimed. */
+static size_t
+available_cnt (void)
+{
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  return (free_cnt - reserved_cnt
+          + (claim_owner == thread_current () ? claim_cnt : 0));
+}
+
+/* Allocates CNT sectors, which must be free, starting at SECTOR,
+   taking them out of the running thread's claim first. */
+static void
+take_run (block_sector_t sector, size_t cnt)
+{
+  set_run (sector, cnt, true);
+  next_sector = sector + cnt;
+  if (claim_owner == thread_current ())
+    {
+      size_t claimed = cnt < claim_cnt ? cnt : claim_cnt;
+      claim_cnt -= claimed;
+      reserved_cnt -= claimed;
+    }
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after GOAL as possible, and stores the first into *SECTORP.  A
+   GOAL of 0 means no preference.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
-free_map_allocate (block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
+{
+  size_t start;
+
+  ASSERT (cnt > 0);
+  lock_acquire (&free_map_lock);
+  start = (available_cnt () >= cnt
+           ? scan_from (choose_goal (goal), cnt) : BITMAP_ERROR);
+  if (start != BITMAP_ERROR)
+    {
+      take_run (start, cnt);
+      *sectorp = start;
+    }
+  lock_release (&free_map_lock);
+  return start != BITMAP_ERROR;
+}
+
+/* Allocates a run of up to CNT consecutive sectors from the free
+   map, preferring one that starts at GOAL, then a run of all CNT
+   sectors after GOAL, then any run, and stores the first sector
+   into *SECTORP.  A GOAL of 0 means no preference.
+   Returns the number of sectors allocated, 0 if the disk is
+   full. */
+size_t
+free_map_allocate_run (block_sector_t goal, size_t cnt,
+                       block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, 1, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t size = bitmap_size (free_map);
+  size_t start, run;
+
+  ASSERT (cnt > 0);
+  lock_acquire (&free_map_lock);
+  if (cnt > available_cnt ())
+    cnt = available_cnt ();
+  goal = choose_goal (goal);
+  if (cnt == 0)
+    start = BITMAP_ERROR;
+  else if (!bitmap_test (free_map, goal))
+    start = goal;
+  else
+    {
+      start = scan_from (goal, cnt);
+      if (start == BITMAP_ERROR)
+        start = scan_from (goal, 1);
+    }
+  if (start == BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, 1, false);
-      sector = BITMAP_ERROR;
+      lock_release (&free_map_lock);
+      return 0;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  for (run = 1; run < cnt && start + run < size; run++)
+    if (bitmap_test (free_map, start + run))
+      break;
+  take_run (start, run);
+  lock_release (&free_map_lock);
+
+  *sectorp = start;
+  return run;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
-free_map_release (block_sector_t sector)
+free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, 1));
-  bitmap_set_multiple (free_map, sector, 1, false);
-  bitmap_write (free_map, free_map_file);
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  set_run (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Sets aside CNT free sectors for data that will be allocated
+   later.  Returns false if fewer than CNT unreserved sectors are
+   free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Returns CNT sectors set aside by free_map_reserve(), just before
+   they are allocated or when they are no longer needed. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Lets the running thread allocate CNT of the sectors it set aside
+   with free_map_reserve(), until it calls free_map_unclaim(), so
+   that no other thread can take them first.  Other threads that
+   claim sectors wait until then. */
+void
+free_map_claim (size_t cnt)
+{
+  lock_acquire (&claim_lock);
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  claim_owner = thread_current ();
+  claim_cnt = cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Ends the running thread's claim and returns the number of claimed
+   sectors it did not allocate, which stay reserved. */
+size_t
+free_map_unclaim (void)
+{
+  size_t cnt;
+
+  ASSERT (claim_owner == thread_current ());
+  lock_acquire (&free_map_lock);
+  cnt = claim_cnt;
+  claim_owner = NULL;
+  claim_cnt = 0;
+  lock_release (&free_map_lock);
+  lock_release (&claim_lock);
+  return cnt;
+}
+
+/* Writes the sectors of the free map file that changed since they
+   were last written. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_map); i++)
+      if (bitmap_test (dirty_map, i)
+          && bitmap_write_range (free_map, free_map_file,
+                                 i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        bitmap_reset (dirty_map, i);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +283,17 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  bitmap_set_all (dirty_map, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +311,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
 }
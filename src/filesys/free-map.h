@@ -10,8 +10,15 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
-bool free_map_allocate (block_sector_t *);
-void free_map_release (block_sector_t);
+bool free_map_allocate (size_t cnt, block_sector_t goal, block_sector_t *);
+size_t free_map_allocate_run (block_sector_t goal, size_t cnt,
+                              block_sector_t *);
+void free_map_release (block_sector_t, size_t cnt);
+bool free_map_reserve (size_t cnt);
+void free_map_unreserve (size_t cnt);
+void free_map_claim (size_t cnt);
+size_t free_map_unclaim (void);
 
 #endif /* filesys/free-map.h */
@@ -1,5 +1,5 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <stdio.h>
 #include <round.h>
@@ -10,33 +10,112 @@
 #include "filesys/cache.h"
 #include "threads/synch.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Identifies an inode.  The low byte of the magic number is the
+   version of the inode's block map layout. */
+#define INODE_MAGIC 0x494e4f00
+#define INODE_VERSION_MASK 0xff
+#define INODE_INDEXED_VERSION 0x44      /* "INOD", the original layout. */
+#define INODE_EXTENT_VERSION 0x45       /* "INOE". */
 
 #define NUM_DIRECT 10
 #define NUM_INDIRECT 1
 #define NUM_DOUBLE_INDIRECT 1
-#define NUM_SECTORS 16522
+#define NUM_TRIPLE_INDIRECT 1
+#define PTRS_PER_BLOCK 128              /* Entries in an indirect block. */
+
+#define NUM_EXTENTS 40                  /* Extents in an extent inode. */
+#define EXTENTS_PER_LEAF 42             /* Extents in a leaf block. */
+#define LEAVES_PER_INDEX 64             /* Leaves in an index block. */
+
+/* Read-ahead window bounds, in blocks.  The window starts at
+   RA_MIN_WINDOW once a stream looks sequential and doubles on each
+   further sequential read. */
+#define RA_MIN_WINDOW 2
+#define RA_MAX_WINDOW 32
+
+/* Blocks that reads and writes map with one walk of the block
+   map. */
+#define MAP_BATCH 32
+
+/* Data blocks an inode may have written but not yet allocated. */
+#define MAX_DELAYED 64
+
+/* Free sectors reserved for each delayed block: one for the block
+   itself and room for the block map sectors that placing it may
+   add, three for a block under the triple indirect block. */
+#define DELAY_RESERVE 4
+
+/* Block map layouts. */
+enum inode_format
+  {
+    INODE_INDEXED,                      /* Direct and indirect blocks. */
+    INODE_EXTENT                        /* Runs of contiguous sectors. */
+  };
+
+/* Layout of inodes created from now on. */
+static enum inode_format new_format = INODE_INDEXED;
+
+/* Block map of an indexed inode: one pointer per block. */
+struct index_map
+  {
+    block_sector_t direct[NUM_DIRECT];
+    block_sector_t indirect[NUM_INDIRECT];
+    block_sector_t double_indirect[NUM_DOUBLE_INDIRECT];
+    block_sector_t triple_indirect[NUM_TRIPLE_INDIRECT];
+  };
+
+/* LENGTH consecutive sectors starting at START, holding a file's
+   blocks from BLOCK on. */
+struct extent
+  {
+    uint32_t block;                     /* First block covered. */
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Block map of an extent inode.  Extents are kept in block order,
+   the first ones in the inode and the rest in leaf blocks listed
+   by an index block. */
+struct extent_map
+  {
+    uint32_t extent_cnt;                /* Extents in EXTENTS. */
+    uint32_t leaf_cnt;                  /* Leaves in the index. */
+    block_sector_t index;               /* Index block, 0 if none. */
+    uint32_t leaf_block;                /* First block in the leaves. */
+    struct extent extents[NUM_EXTENTS];
+  };
+
+/* A leaf block of extents. */
+struct extent_leaf
+  {
+    uint32_t cnt;                       /* Extents in EXTENTS. */
+    struct extent extents[EXTENTS_PER_LEAF];
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* Entry in an index block: a leaf and the first block it covers.
+   An index block holds LEAVES_PER_INDEX of them. */
+struct leaf_ref
+  {
+    uint32_t block;                     /* First block in the leaf. */
+    block_sector_t sector;              /* Sector of the leaf. */
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
     volatile off_t length;                       /* File size in bytes. */
-    block_sector_t direct[NUM_DIRECT];
-    block_sector_t indirect[NUM_INDIRECT];
-    block_sector_t double_indirect[NUM_DOUBLE_INDIRECT];
+    union
+      {
+        struct index_map index;         /* If INODE_INDEXED_VERSION. */
+        struct extent_map ext;          /* If INODE_EXTENT_VERSION. */
+      };
 
     bool isdir;                        /* Is directory? */
     int entry_cnt;                      /* Number of entries in directory */
 
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[112];               /* Not used. */
-  };
-
-struct indirect_block
-  {
-    block_sector_t indirect_blocks[128];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -50,139 +129,922 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* Number of openers, protected
+                                           by open_inodes_lock. */
+    bool closing;                       /* Last close under way?
+                                           Protected by
+                                           open_inodes_lock. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct lock extension_lock;
-    //struct inode_disk data;             /* Inode content. */
+    struct lock extension_lock;         /* Serializes writes past EOF. */
+    struct lock lock;                   /* Protects DATA. */
+    struct lock dir_lock;               /* Serializes directory changes. */
+    void *dir_hints;                    /* Directory's in-memory hints,
+                                           protected by DIR_LOCK. */
+    struct inode_disk data;             /* Inode content, written through
+                                           to the buffer cache. */
+
+    /* Blocks written but not allocated yet, each cached under a
+       placeholder from cache_get_delayed().  Protected by LOCK. */
+    struct
+      {
+        size_t block;                   /* Block index in the file. */
+        block_sector_t sector;          /* Placeholder sector. */
+      }
+    delayed[MAX_DELAYED];
+    size_t delayed_cnt;
+    size_t reserved_cnt;                /* Free sectors reserved for
+                                           placing them. */
+
+    /* Sequential read detection. */
+    off_t ra_pos;                       /* Where a sequential read starts. */
+    size_t ra_window;                   /* Blocks to prefetch, 0 if random. */
+    size_t ra_end;                      /* Blocks up to here requested. */
   };
 
 
-// Must free inode_disk after this function has been called
-static struct inode_disk*
-get_disk_inode (const struct inode *inode)
+/* Returns the cache class for the data blocks of the inode at
+   SECTOR, so the buffer cache can keep directory and free map
+   contents resident. */
+static enum cache_class
+data_class (block_sector_t sector, const struct inode_disk *disk_inode)
 {
-  struct inode_disk *disk_inode = NULL;
+  if (sector == FREE_MAP_SECTOR)
+    return CACHE_FREE_MAP;
+  return disk_inode->isdir ? CACHE_DIR : CACHE_DATA;
+}
 
-  disk_inode = calloc (1, sizeof *disk_inode);
+/* Copies INODE's in-memory data to its sector in the buffer cache.
+   INODE's lock must be held. */
+static void
+inode_write_through (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  cache_write_at (inode->sector, CACHE_INODE, &inode->data, 0,
+                  BLOCK_SECTOR_SIZE);
+}
 
-  if (disk_inode != NULL)
+/* Allocates a sector as close after GOAL as possible for a new
+   block of class CLASS and zeros it in the cache, without reading
+   the disk.  Stores the sector into *SECTORP and returns true if
+   successful. */
+static bool
+allocate_zeroed (block_sector_t *sectorp, block_sector_t goal,
+                 enum cache_class class)
+{
+  if (!free_map_allocate (1, goal, sectorp))
+    return false;
+  cache_put (cache_get_zeroed (*sectorp, class), true);
+  return true;
+}
+
+/* Returns entry IDX of the indirect block at SECTOR, read in place
+   in the cache.  If CREATE and the entry is empty, first allocates a
+   block of class CLASS for it near GOAL. */
+static block_sector_t
+indirect_entry (block_sector_t sector, size_t idx, enum cache_class class,
+                block_sector_t goal, bool create)
+{
+  struct cache_entry *c = cache_get (sector, CACHE_INDIRECT,
+                                     create ? CACHE_EXCLUSIVE : CACHE_SHARED);
+  block_sector_t *table = cache_buffer (c);
+  bool dirty = false;
+
+  if (table[idx] == 0 && create)
+    dirty = allocate_zeroed (&table[idx], goal, class);
+  sector = table[idx];
+  cache_put (c, dirty);
+  return sector;
+}
+
+/* Returns the layout of DISK_INODE's block map. */
+static enum inode_format
+inode_format (const struct inode_disk *disk_inode)
+{
+  if ((disk_inode->magic & INODE_VERSION_MASK) == INODE_EXTENT_VERSION)
+    return INODE_EXTENT;
+  return INODE_INDEXED;
+}
+
+/* Finds the tree of indexed inode block map MAP that holds block
+   BLOCK_IDX.  Stores a pointer to the tree's root pointer into
+   *ROOTP and the block's index within the tree into *IDXP, and
+   returns the tree's levels of indirection, 0 for a direct block,
+   or -1 if BLOCK_IDX is past the largest file the map can hold. */
+static int
+index_tree (struct index_map *map, size_t block_idx, block_sector_t **rootp,
+            size_t *idxp)
+{
+  size_t span = 1;
+  int depth;
+
+  if (block_idx < NUM_DIRECT)
+  {
+    *rootp = &map->direct[block_idx];
+    *idxp = 0;
+    return 0;
+  }
+  block_idx -= NUM_DIRECT;
+
+  for (depth = 1; depth <= 3; depth++)
   {
-    cache_read_at (inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-    return disk_inode;
+    span *= PTRS_PER_BLOCK;
+    if (block_idx < span)
+    {
+      *rootp = (depth == 1 ? &map->indirect[0]
+                : depth == 2 ? &map->double_indirect[0]
+                : &map->triple_indirect[0]);
+      *idxp = block_idx;
+      return depth;
+    }
+    block_idx -= span;
   }
+  return -1;
+}
+
+/* Returns the number of blocks under each entry of a block DEPTH
+   levels of indirection above the data. */
+static size_t
+index_span (int depth)
+{
+  size_t span = 1;
 
-  return NULL;
+  while (depth-- > 1)
+    span *= PTRS_PER_BLOCK;
+  return span;
 }
 
+/* Returns the sector holding block BLOCK_IDX of indexed inode
+   DISK_INODE, or 0 if the block is not allocated.  If CREATE,
+   missing blocks are allocated near GOAL, data blocks as class
+   CLASS, and 0 means the disk is full or the block is past the
+   largest file. */
 static block_sector_t
-inode_block_to_sector (struct inode_disk *disk_inode, size_t block_idx, struct indirect_block *indirect_block,
-    struct indirect_block *double_indirect_block, bool create)
+index_block_to_sector (struct inode_disk *disk_inode, size_t block_idx,
+                       enum cache_class class, block_sector_t goal,
+                       bool create)
 {
-  // printf ("block idx : %d\n", block_idx);
+  block_sector_t *root, sector;
+  size_t idx, span;
+  int depth;
 
-  block_sector_t sector;
-  if (block_idx < NUM_DIRECT)
+  depth = index_tree (&disk_inode->index, block_idx, &root, &idx);
+  if (depth < 0)
+    return 0;
+  if (*root == 0
+      && (!create || !allocate_zeroed (root, goal, (depth == 0 ? class
+                                                    : CACHE_INDIRECT))))
+    return 0;
+
+  sector = *root;
+  for (span = index_span (depth); depth > 0 && sector != 0;
+       depth--, span /= PTRS_PER_BLOCK)
+    sector = indirect_entry (sector, idx / span % PTRS_PER_BLOCK,
+                             depth == 1 ? class : CACHE_INDIRECT, goal,
+                             create);
+  return sector;
+}
+
+/* Copies CNT entries of the indirect block at SECTOR, starting at
+   entry IDX, into SECTORS, or zeros if SECTOR is 0. */
+static void
+indirect_range (block_sector_t sector, size_t idx, size_t cnt,
+                block_sector_t sectors[])
+{
+  struct cache_entry *c;
+
+  if (sector == 0)
+  {
+    memset (sectors, 0, cnt * sizeof *sectors);
+    return;
+  }
+  c = cache_get (sector, CACHE_INDIRECT, CACHE_SHARED);
+  memcpy (sectors, (block_sector_t *) cache_buffer (c) + idx,
+          cnt * sizeof *sectors);
+  cache_put (c, false);
+}
+
+/* Stores the sectors holding CNT blocks of indexed inode
+   DISK_INODE, starting at BLOCK_IDX, into SECTORS, reading each
+   indirect block that maps them once. */
+static void
+index_map_range (struct inode_disk *disk_inode, size_t block_idx, size_t cnt,
+                 block_sector_t sectors[])
+{
+  size_t n;
+
+  for (; cnt > 0; sectors += n, block_idx += n, cnt -= n)
   {
-    sector = disk_inode->direct[block_idx];
-    if (sector == 0 && create)
+    block_sector_t *root, sector;
+    size_t idx, span;
+    int depth;
+
+    depth = index_tree (&disk_inode->index, block_idx, &root, &idx);
+    if (depth < 0)
     {
-      if (!free_map_allocate (&disk_inode->direct[block_idx]))
-        return 0;
-      // printf ("direct sector created : %d\n", disk_inode->direct[block_idx]);
+      memset (sectors, 0, cnt * sizeof *sectors);
+      return;
+    }
+    if (depth == 0)
+    {
+      sectors[0] = *root;
+      n = 1;
+      continue;
+    }
+
+    /* Walk down to the table of data block pointers, then copy the
+       run of entries the range covers. */
+    n = PTRS_PER_BLOCK - idx % PTRS_PER_BLOCK;
+    if (n > cnt)
+      n = cnt;
+    sector = *root;
+    for (span = index_span (depth); span > 1 && sector != 0;
+         span /= PTRS_PER_BLOCK)
+      sector = indirect_entry (sector, idx / span % PTRS_PER_BLOCK,
+                               CACHE_INDIRECT, 0, false);
+    indirect_range (sector, idx % PTRS_PER_BLOCK, n, sectors);
+  }
+}
+
+/* Frees the indirect block at SECTOR, if any, and the DEPTH levels
+   of blocks below it. */
+static void
+index_release (block_sector_t sector, int depth)
+{
+  if (sector == 0)
+    return;
+  if (depth > 0)
+  {
+    struct cache_entry *c = cache_get (sector, CACHE_INDIRECT, CACHE_SHARED);
+    block_sector_t *table = cache_buffer (c);
+    size_t i;
+
+    for (i = 0; i < BLOCK_SECTOR_SIZE / sizeof *table; i++)
+      index_release (table[i], depth - 1);
+    cache_put (c, false);
+  }
+  free_map_release (sector, 1);
+}
+
+/* Returns the number of the CNT extents in EXTENTS, which are in
+   block order, that start at or before BLOCK_IDX. */
+static size_t
+extent_search (const struct extent *extents, size_t cnt, size_t block_idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (extents[mid].block <= block_idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Returns the number of the CNT leaves in REFS that start at or
+   before BLOCK_IDX. */
+static size_t
+leaf_search (const struct leaf_ref *refs, size_t cnt, size_t block_idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (refs[mid].block <= block_idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Copies the last extent of DISK_INODE that starts at or before
+   BLOCK_IDX into *E.  Returns false if there is none.  If NEXT is
+   nonnull, stores into it the first block of the extent after that
+   one, or SIZE_MAX if it is the last. */
+static bool
+extent_find (const struct inode_disk *disk_inode, size_t block_idx,
+             struct extent *e, size_t *next)
+{
+  const struct extent_map *map = &disk_inode->ext;
+  struct cache_entry *c;
+  struct extent_leaf *leaf;
+  block_sector_t sector;
+  size_t i, l, next_leaf;
+
+  if (map->leaf_cnt == 0 || block_idx < map->leaf_block)
+  {
+    i = extent_search (map->extents, map->extent_cnt, block_idx);
+    if (next != NULL)
+      *next = (i < map->extent_cnt ? map->extents[i].block
+               : map->leaf_cnt > 0 ? map->leaf_block : SIZE_MAX);
+    if (i == 0)
+      return false;
+    *e = map->extents[i - 1];
+    return true;
+  }
+
+  c = cache_get (map->index, CACHE_INDIRECT, CACHE_SHARED);
+  l = leaf_search (cache_buffer (c), map->leaf_cnt, block_idx);
+  sector = ((struct leaf_ref *) cache_buffer (c))[l - 1].sector;
+  next_leaf = (l < map->leaf_cnt
+               ? ((struct leaf_ref *) cache_buffer (c))[l].block : SIZE_MAX);
+  cache_put (c, false);
+
+  c = cache_get (sector, CACHE_INDIRECT, CACHE_SHARED);
+  leaf = cache_buffer (c);
+  i = extent_search (leaf->extents, leaf->cnt, block_idx);
+  if (i > 0)
+    *e = leaf->extents[i - 1];
+  if (next != NULL)
+    *next = i < leaf->cnt ? leaf->extents[i].block : next_leaf;
+  cache_put (c, false);
+  return i > 0;
+}
+
+/* Extends PREV by NEXT if NEXT follows it both in the file and on
+   disk.  Returns true if successful. */
+static bool
+extent_merge (struct extent *prev, const struct extent *next)
+{
+  if (prev->block + prev->length != next->block
+      || prev->start + prev->length != next->start)
+    return false;
+  prev->length += next->length;
+  return true;
+}
+
+/* Inserts E at position IDX of the CNT extents in EXTENTS, which
+   must have room for one more. */
+static void
+extent_shift_in (struct extent *extents, size_t cnt, size_t idx,
+                 struct extent e)
+{
+  memmove (extents + idx + 1, extents + idx, (cnt - idx) * sizeof *extents);
+  extents[idx] = e;
+}
+
+/* Adds extent E to the leaves of extent map MAP, creating the index
+   block and the first leaf or splitting a full leaf as needed.
+   Returns false if a block cannot be allocated or the index is
+   full. */
+static bool
+leaf_insert (struct extent_map *map, struct extent e)
+{
+  struct cache_entry *index_c, *leaf_c;
+  struct leaf_ref *refs;
+  struct extent_leaf *leaf;
+  size_t l, i;
 
-      return disk_inode->direct[block_idx];
+  if (map->leaf_cnt == 0)
+  {
+    block_sector_t index, sector;
+
+    if (!allocate_zeroed (&index, 0, CACHE_INDIRECT))
+      return false;
+    if (!allocate_zeroed (&sector, index, CACHE_INDIRECT))
+    {
+      free_map_release (index, 1);
+      return false;
     }
-    // printf ("direct : %d\n", sector);
-    return sector;
+    index_c = cache_get (index, CACHE_INDIRECT, CACHE_EXCLUSIVE);
+    refs = cache_buffer (index_c);
+    refs[0].block = e.block;
+    refs[0].sector = sector;
+    cache_put (index_c, true);
+    map->index = index;
+    map->leaf_cnt = 1;
+    map->leaf_block = e.block;
   }
-  //indirect
-  else if (NUM_DIRECT <= block_idx && block_idx < NUM_DIRECT + 128)
+
+  index_c = cache_get (map->index, CACHE_INDIRECT, CACHE_EXCLUSIVE);
+  refs = cache_buffer (index_c);
+  l = leaf_search (refs, map->leaf_cnt, e.block);
+  if (l > 0)
+    l--;
+  leaf_c = cache_get (refs[l].sector, CACHE_INDIRECT, CACHE_EXCLUSIVE);
+  leaf = cache_buffer (leaf_c);
+  i = extent_search (leaf->extents, leaf->cnt, e.block);
+  if (i > 0 && extent_merge (&leaf->extents[i - 1], &e))
+  {
+    cache_put (leaf_c, true);
+    cache_put (index_c, false);
+    return true;
+  }
+
+  if (leaf->cnt == EXTENTS_PER_LEAF)
   {
-    if (create && disk_inode->indirect[0] == 0)
+    /* Split the leaf, moving its upper half to a new leaf after
+       it.  A leaf that E would extend stays full instead, so files
+       that grow at the end pack their leaves. */
+    size_t half = i < EXTENTS_PER_LEAF ? EXTENTS_PER_LEAF / 2 : i;
+    struct cache_entry *next_c;
+    struct extent_leaf *next;
+    block_sector_t sector;
+
+    if (map->leaf_cnt == LEAVES_PER_INDEX
+        || !allocate_zeroed (&sector, refs[l].sector, CACHE_INDIRECT))
     {
-      if(!free_map_allocate (&disk_inode->indirect[0]))
-        return 0;
-      cache_write_at (disk_inode->indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
+      cache_put (leaf_c, false);
+      cache_put (index_c, false);
+      return false;
     }
-    else if (disk_inode->indirect[0] == 0)
-      return 0;
-    cache_read_at (disk_inode->indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    sector = indirect_block->indirect_blocks[block_idx - NUM_DIRECT];
-    if (sector == 0 && create)
+    next_c = cache_get (sector, CACHE_INDIRECT, CACHE_EXCLUSIVE);
+    next = cache_buffer (next_c);
+    next->cnt = leaf->cnt - half;
+    memcpy (next->extents, leaf->extents + half,
+            next->cnt * sizeof *next->extents);
+    leaf->cnt = half;
+    memmove (refs + l + 2, refs + l + 1,
+             (map->leaf_cnt - l - 1) * sizeof *refs);
+    refs[l + 1].block = next->cnt > 0 ? next->extents[0].block : e.block;
+    refs[l + 1].sector = sector;
+    map->leaf_cnt++;
+
+    if (i >= half)
     {
-      if (!free_map_allocate (&indirect_block->indirect_blocks[block_idx - NUM_DIRECT]))
-        return 0;
-      cache_write_at (disk_inode->indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-
-      // printf ("indirect sector created : %d\n", indirect_block->indirect_blocks[block_idx - NUM_DIRECT]);
-      return indirect_block->indirect_blocks[block_idx - NUM_DIRECT];
+      cache_put (leaf_c, true);
+      leaf_c = next_c;
+      leaf = next;
+      i -= half;
+      l++;
     }
-    // printf ("existing indirect : %d\n", sector);
-    return sector;
+    else
+      cache_put (next_c, true);
   }
-  //double indirect
-  else if (NUM_DIRECT + 128 <= block_idx && block_idx < NUM_SECTORS)
+
+  extent_shift_in (leaf->extents, leaf->cnt++, i, e);
+  if (i == 0)
+  {
+    refs[l].block = e.block;
+    if (l == 0)
+      map->leaf_block = e.block;
+  }
+  cache_put (leaf_c, true);
+  cache_put (index_c, true);
+  return true;
+}
+
+/* Adds extent E, which must not overlap the others, to extent inode
+   DISK_INODE, merging it into the extent before it when the two are
+   contiguous on disk.  Extents that do not fit in the inode spill
+   into the leaves.  Returns false if a needed block cannot be
+   allocated. */
+static bool
+extent_insert (struct inode_disk *disk_inode, struct extent e)
+{
+  struct extent_map *map = &disk_inode->ext;
+  size_t i;
+
+  if (map->leaf_cnt > 0 && e.block >= map->leaf_block)
+    return leaf_insert (map, e);
+
+  i = extent_search (map->extents, map->extent_cnt, e.block);
+  if (i > 0 && extent_merge (&map->extents[i - 1], &e))
+    return true;
+  if (map->extent_cnt < NUM_EXTENTS)
   {
-    if (create && disk_inode->double_indirect[0] == 0)
+    extent_shift_in (map->extents, map->extent_cnt++, i, e);
+    return true;
+  }
+
+  /* The inode is full, so its last extent moves to the leaves. */
+  if (i == NUM_EXTENTS)
+    return leaf_insert (map, e);
+  if (!leaf_insert (map, map->extents[NUM_EXTENTS - 1]))
+    return false;
+  extent_shift_in (map->extents, NUM_EXTENTS - 1, i, e);
+  return true;
+}
+
+/* Allocates up to CNT blocks of extent inode DISK_INODE, starting
+   at block BLOCK_IDX, as one run of sectors starting at GOAL if
+   possible.  If ZERO, zeros them in the cache as class CLASS.
+   Stores the first sector into *SECTORP and returns the number of
+   blocks allocated, 0 if the disk is full. */
+static size_t
+extent_allocate (struct inode_disk *disk_inode, size_t block_idx,
+                 size_t cnt, block_sector_t goal, enum cache_class class,
+                 bool zero, block_sector_t *sectorp)
+{
+  struct extent e;
+  size_t i;
+
+  e.block = block_idx;
+  e.length = free_map_allocate_run (goal, cnt, &e.start);
+  if (e.length == 0)
+    return 0;
+  if (zero)
+    for (i = 0; i < e.length; i++)
+      cache_put (cache_get_zeroed (e.start + i, class), true);
+  if (!extent_insert (disk_inode, e))
+  {
+    /* The zeroed entries must not be written over whatever gets
+       the sectors next. */
+    for (i = 0; i < e.length; i++)
+      cache_discard (e.start + i);
+    free_map_release (e.start, e.length);
+    return 0;
+  }
+  *sectorp = e.start;
+  return e.length;
+}
+
+/* Stores the sectors holding CNT blocks of extent inode DISK_INODE,
+   starting at BLOCK_IDX, into SECTORS, looking up each extent, and
+   each hole between extents, that maps them once. */
+static void
+extent_map_range (const struct inode_disk *disk_inode, size_t block_idx,
+                  size_t cnt, block_sector_t sectors[])
+{
+  size_t i, n;
+
+  for (; cnt > 0; sectors += n, block_idx += n, cnt -= n)
+  {
+    struct extent e;
+    size_t next;
+
+    if (!extent_find (disk_inode, block_idx, &e, &next)
+        || block_idx - e.block >= e.length)
     {
-      if (!free_map_allocate (&disk_inode->double_indirect[0]))
-        return 0;
-      cache_write_at (disk_inode->double_indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
+      /* A hole, up to the next extent. */
+      n = next - block_idx < cnt ? next - block_idx : cnt;
+      memset (sectors, 0, n * sizeof *sectors);
+      continue;
     }
-    else if (disk_inode->double_indirect[0] == 0)
-      return 0;
+    n = e.length - (block_idx - e.block);
+    if (n > cnt)
+      n = cnt;
+    for (i = 0; i < n; i++)
+      sectors[i] = e.start + (block_idx - e.block) + i;
+  }
+}
+
+/* Frees the extents of the leaf at SECTOR and the leaf itself. */
+static void
+extent_release_leaf (block_sector_t sector)
+{
+  struct cache_entry *c = cache_get (sector, CACHE_INDIRECT, CACHE_SHARED);
+  struct extent_leaf *leaf = cache_buffer (c);
+  size_t i;
+
+  for (i = 0; i < leaf->cnt; i++)
+    free_map_release (leaf->extents[i].start, leaf->extents[i].length);
+  cache_put (c, false);
+  free_map_release (sector, 1);
+}
 
-    int index = block_idx - (NUM_DIRECT + 128);
+/* Stores the sectors holding CNT blocks of DISK_INODE, starting at
+   BLOCK_IDX, into SECTORS, with 0 for blocks that are not
+   allocated.  The block map is walked once for the whole range. */
+static void
+inode_map_range (struct inode_disk *disk_inode, size_t block_idx, size_t cnt,
+                 block_sector_t sectors[])
+{
+  if (inode_format (disk_inode) == INODE_EXTENT)
+    extent_map_range (disk_inode, block_idx, cnt, sectors);
+  else
+    index_map_range (disk_inode, block_idx, cnt, sectors);
+}
 
-    cache_read_at (disk_inode->double_indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
+/* Returns the sector holding block BLOCK_IDX of DISK_INODE, or 0 if
+   the block is not allocated. */
+static block_sector_t
+inode_block_to_sector (struct inode_disk *disk_inode, size_t block_idx)
+{
+  block_sector_t sector;
 
-    if (create && indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE] == 0)
+  inode_map_range (disk_inode, block_idx, 1, &sector);
+  return sector;
+}
+
+/* Allocates up to CNT blocks of DISK_INODE, whose inode is at
+   INODE_SECTOR, starting at BLOCK_IDX, which must not be allocated
+   yet, as data blocks of class CLASS.  Blocks are placed right
+   after the file's previous block, or after the inode for a file's
+   first block, when those sectors are free.  Stores the sector of
+   block BLOCK_IDX into *SECTORP and returns the number of blocks
+   allocated, 0 if the disk is full.  Changes to the block map are
+   made in DISK_INODE, which the caller must write back.
+
+   New blocks are zeroed in the cache unless OVERWRITE, in which
+   case the caller must fill every block allocated before anyone
+   else can map it.  Indexed inodes zero their blocks regardless. */
+static size_t
+inode_allocate (struct inode_disk *disk_inode, block_sector_t inode_sector,
+                size_t block_idx, size_t cnt, enum cache_class class,
+                bool overwrite, block_sector_t *sectorp)
+{
+  block_sector_t goal = inode_sector + 1;
+
+  if (inode_format (disk_inode) == INODE_EXTENT)
+  {
+    struct extent e;
+
+    if (extent_find (disk_inode, block_idx, &e, NULL))
+      goal = e.start + (block_idx - e.block);
+    return extent_allocate (disk_inode, block_idx, cnt, goal, class,
+                            !overwrite, sectorp);
+  }
+
+  if (block_idx > 0)
+  {
+    block_sector_t prev = inode_block_to_sector (disk_inode, block_idx - 1);
+    if (prev != 0)
+      goal = prev + 1;
+  }
+  *sectorp = index_block_to_sector (disk_inode, block_idx, class, goal, true);
+  return *sectorp != 0;
+}
+
+/* Frees all the data and block map sectors of DISK_INODE. */
+static void
+inode_release (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  if (inode_format (disk_inode) == INODE_EXTENT)
+  {
+    struct extent_map *map = &disk_inode->ext;
+
+    for (i = 0; i < map->extent_cnt; i++)
+      free_map_release (map->extents[i].start, map->extents[i].length);
+    if (map->leaf_cnt > 0)
     {
-      if (!free_map_allocate (&indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE]))
-        return 0;
-      cache_write_at (indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE], double_indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      cache_write_at (disk_inode->double_indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
+      struct cache_entry *c = cache_get (map->index, CACHE_INDIRECT,
+                                         CACHE_SHARED);
+      struct leaf_ref *refs = cache_buffer (c);
+
+      for (i = 0; i < map->leaf_cnt; i++)
+        extent_release_leaf (refs[i].sector);
+      cache_put (c, false);
+      free_map_release (map->index, 1);
     }
-    else if (indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE] == 0)
-      return 0;
+    return;
+  }
+
+  for (i = 0; i < NUM_DIRECT; i++)
+    index_release (disk_inode->index.direct[i], 0);
+  index_release (disk_inode->index.indirect[0], 1);
+  index_release (disk_inode->index.double_indirect[0], 2);
+  index_release (disk_inode->index.triple_indirect[0], 3);
+}
+
+/* Returns the placeholder holding delayed block BLOCK_IDX of INODE,
+   or 0 if the block is not delayed.  INODE's lock must be held. */
+static block_sector_t
+inode_delayed_sector (const struct inode *inode, size_t block_idx)
+{
+  size_t i;
 
-    cache_read_at (indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE], double_indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    sector = double_indirect_block->indirect_blocks[index % BLOCK_SECTOR_SIZE];
+  for (i = 0; i < inode->delayed_cnt; i++)
+    if (inode->delayed[i].block == block_idx)
+      return inode->delayed[i].sector;
+  return 0;
+}
+
+/* Allocates sectors for all of INODE's delayed blocks, each run of
+   consecutive blocks together, and moves their data there.  The
+   sectors, and those the block map needs for them, come out of
+   INODE's own reservation, so other allocations cannot use them up
+   first.  Returns true if successful.  Otherwise reports how many
+   blocks could not be placed and keeps them delayed, so that no
+   written data is dropped.  INODE's lock must be held. */
+static bool
+inode_place_delayed (struct inode *inode)
+{
+  enum cache_class class = data_class (inode->sector, &inode->data);
+  size_t i, j, n, left;
 
-    if (sector == 0 && create)
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  if (inode->delayed_cnt == 0)
+    return true;
+
+  /* Sort by block, so runs of blocks can be allocated together. */
+  for (i = 1; i < inode->delayed_cnt; i++)
+    for (j = i; j > 0 && (inode->delayed[j - 1].block
+                          > inode->delayed[j].block); j--)
     {
-      if (!free_map_allocate (&double_indirect_block->indirect_blocks[index % BLOCK_SECTOR_SIZE]))
-        return 0;
-      cache_write_at (indirect_block->indirect_blocks[index / BLOCK_SECTOR_SIZE],
-                      double_indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      cache_write_at (disk_inode->double_indirect[0], indirect_block->indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-
-      // printf ("double indirect sector created : %d\n", double_indirect_block->indirect_blocks[index % BLOCK_SECTOR_SIZE]);
-      return double_indirect_block->indirect_blocks[index % BLOCK_SECTOR_SIZE];
+      size_t block = inode->delayed[j].block;
+      block_sector_t sector = inode->delayed[j].sector;
+
+      inode->delayed[j] = inode->delayed[j - 1];
+      inode->delayed[j - 1].block = block;
+      inode->delayed[j - 1].sector = sector;
     }
-    // printf ("existing double indirect : %d\n", sector);
-    return sector;
+
+  free_map_claim (inode->reserved_cnt);
+  for (i = 0; i < inode->delayed_cnt; i += n)
+  {
+    block_sector_t sector;
+
+    for (j = i + 1; j < inode->delayed_cnt; j++)
+      if (inode->delayed[j].block != inode->delayed[j - 1].block + 1)
+        break;
+    n = inode_allocate (&inode->data, inode->sector, inode->delayed[i].block,
+                        j - i, class, true, &sector);
+    if (n == 0)
+      break;
+    for (j = 0; j < n; j++)
+      cache_place (inode->delayed[i + j].sector, sector + j);
+  }
+  inode->reserved_cnt = free_map_unclaim ();
+  inode_write_through (inode);
+
+  /* Keep what is left delayed, with what is left of the
+     reservation, for a later try. */
+  left = inode->delayed_cnt - i;
+  memmove (inode->delayed, inode->delayed + i, left * sizeof *inode->delayed);
+  inode->delayed_cnt = left;
+  if (left > 0)
+  {
+    printf ("inode %"PRDSNu": %zu delayed blocks could not be placed\n",
+            inode->sector, left);
+    return false;
+  }
+  free_map_unreserve (inode->reserved_cnt);
+  inode->reserved_cnt = 0;
+  return true;
+}
+
+/* Returns a placeholder to hold new block BLOCK_IDX of INODE until
+   its sector is allocated, or 0 if the block must be allocated now.
+   Only file data is delayed.  INODE's lock must be held. */
+static block_sector_t
+inode_delay_block (struct inode *inode, size_t block_idx)
+{
+  struct cache_entry *c;
+  block_sector_t sector;
+
+  if (data_class (inode->sector, &inode->data) != CACHE_DATA)
+    return 0;
+  if (inode->delayed_cnt == MAX_DELAYED && !inode_place_delayed (inode))
+    return 0;
+  if (!free_map_reserve (DELAY_RESERVE))
+  {
+    /* Placing our own delayed blocks gives back the part of their
+       reservation they do not need. */
+    if (inode->delayed_cnt == 0 || !inode_place_delayed (inode)
+        || !free_map_reserve (DELAY_RESERVE))
+      return 0;
+  }
+  c = cache_get_delayed (CACHE_DATA, &sector);
+  if (c == NULL && inode->delayed_cnt > 0)
+  {
+    /* Make room by placing our own delayed blocks. */
+    inode_place_delayed (inode);
+    c = cache_get_delayed (CACHE_DATA, &sector);
   }
-  ASSERT (0);
+  if (c == NULL)
+  {
+    free_map_unreserve (DELAY_RESERVE);
+    return 0;
+  }
+  cache_put (c, true);
+
+  inode->delayed[inode->delayed_cnt].block = block_idx;
+  inode->delayed[inode->delayed_cnt].sector = sector;
+  inode->delayed_cnt++;
+  inode->reserved_cnt += DELAY_RESERVE;
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and each inode's open count.  Ordered
+   before any inode's lock, but never held across disk I/O: an
+   inode is loaded under its own lock, which other threads that
+   find it in the table wait on, and torn down on its last close
+   by the closing thread alone, which other openers wait out on
+   INODE_CLOSED. */
+static struct lock open_inodes_lock;
+static struct condition inode_closed;
+
+static hash_hash_func open_inode_hash;
+static hash_less_func open_inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, open_inode_hash, open_inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_closed);
+}
+
+/* Returns a hash value for the open inode E. */
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if open inode A precedes open inode B. */
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Gives the delayed blocks of every open inode their sectors, so
+   the cache can write them to disk.  The write-back thread calls
+   this every write-back interval, so that a file held open does
+   not keep its newest data only in memory.  Each inode is held
+   open meanwhile, so closing it afterward also frees an inode
+   whose last close could not place its blocks. */
+void
+inode_place_all (void)
+{
+  struct inode **inodes;
+  struct hash_iterator i;
+  size_t cnt = 0, k;
+
+  lock_acquire (&open_inodes_lock);
+  inodes = malloc (hash_size (&open_inodes) * sizeof *inodes);
+  if (inodes == NULL)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+      /* DELAYED_CNT is only a hint here; placement rechecks it.  A
+         closing inode is being placed already. */
+      if (inode->delayed_cnt > 0 && !inode->closing)
+        {
+          inode->open_cnt++;
+          inodes[cnt++] = inode;
+        }
+    }
+  lock_release (&open_inodes_lock);
+
+  for (k = 0; k < cnt; k++)
+    {
+      lock_acquire (&inodes[k]->lock);
+      inode_place_delayed (inodes[k]);
+      lock_release (&inodes[k]->lock);
+      inode_close (inodes[k]);
+    }
+  free (inodes);
+}
+
+/* Gives the delayed blocks of every open inode their sectors, so
+   the cache can write them to disk at shutdown. */
+void
+inode_done (void)
+{
+  inode_place_all ();
+}
+
+/* Makes inodes created from now on use the layout named NAME,
+   "indexed" or "extent".  Returns false if NAME is unknown. */
+bool
+inode_configure_format (const char *name)
+{
+  if (!strcmp (name, "indexed"))
+    new_format = INODE_INDEXED;
+  else if (!strcmp (name, "extent"))
+    new_format = INODE_EXTENT;
+  else
+    return false;
+  return true;
+}
+
+/* Makes inodes created from now on use the same layout as the inode
+   at SECTOR, so a file system keeps the layout it was formatted
+   with. */
+void
+inode_adopt_format (block_sector_t sector)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+
+  if (disk_inode == NULL)
+    return;
+  cache_read_at (sector, CACHE_INODE, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  if ((disk_inode->magic & ~INODE_VERSION_MASK) == INODE_MAGIC)
+    new_format = inode_format (disk_inode);
+  free (disk_inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as a hole, read as zeros, and its
+   blocks are allocated only as they are written, except for the
+   free map's: allocating those changes the free map itself, so they
+   must exist before it is first written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -200,40 +1062,30 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      size_t sectors = (sector == FREE_MAP_SECTOR
+                        ? bytes_to_sectors (length) : 0);
+      enum cache_class class;
+      block_sector_t first;
+      size_t cnt;
+
       //printf ("\nlength %d, sectors %d\n", length, sectors);
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->magic = INODE_MAGIC | (new_format == INODE_EXTENT
+                                         ? INODE_EXTENT_VERSION
+                                         : INODE_INDEXED_VERSION);
       disk_inode->isdir = isdir;
       disk_inode->entry_cnt = 0;
+      class = data_class (sector, disk_inode);
 
-      struct indirect_block *indirect_block = NULL;
-      struct indirect_block *double_indirect_block = NULL;
-
-      if (sectors > NUM_DIRECT)
-        indirect_block = calloc (1, sizeof (struct indirect_block));
-      if (sectors > NUM_DIRECT + 128)
-        double_indirect_block = calloc (1, sizeof (struct indirect_block));
-
-      for (size_t i = 0; i < sectors; i++)
+      for (size_t i = 0; i < sectors; i += cnt)
       {
-        if (i >= NUM_DIRECT)
-          memset (indirect_block, 0, sizeof (struct indirect_block));
-        if (i >= NUM_DIRECT + 128)
-          memset (double_indirect_block, 0, sizeof (struct indirect_block));
-        if (inode_block_to_sector (disk_inode, i, indirect_block, double_indirect_block, true) == 0)
+        cnt = inode_allocate (disk_inode, sector, i, sectors - i, class,
+                              false, &first);
+        if (cnt == 0)
           goto done;
-        // struct inode_disk *empty = calloc (1, sizeof (disk_inode));
-        // cache_write_at (sector_, empty, 0, BLOCK_SECTOR_SIZE);
-        // free (empty);
-        //printf ("allocated sector %d\n", sector_);
-
       }
 
-      cache_write_at (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-
-      free (indirect_block);
-      free (double_indirect_block);
+      cache_write_at (sector, CACHE_INODE, disk_inode, 0, BLOCK_SECTOR_SIZE);
 
       success = true;
     }
@@ -250,35 +1102,54 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  //lock_acquire ()
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
-    }
-
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Return the inode already open at SECTOR, if any, once whoever
+     is loading it is done.  An inode being closed is waited out,
+     since its closer may free it.  Otherwise the new one goes into
+     the table locked, and is loaded outside the table lock. */
   inode->sector = sector;
+  lock_acquire (&open_inodes_lock);
+  while ((e = hash_insert (&open_inodes, &inode->elem)) != NULL
+         && hash_entry (e, struct inode, elem)->closing)
+    cond_wait (&inode_closed, &open_inodes_lock);
+  if (e != NULL)
+    {
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      lock_acquire (&inode->lock);
+      lock_release (&inode->lock);
+      return inode;
+    }
+
+  /* Initialize. */
   inode->open_cnt = 1;
+  inode->closing = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init (&inode->extension_lock);
-  // block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  lock_init (&inode->dir_lock);
+  inode->dir_hints = NULL;
+  inode->delayed_cnt = 0;
+  inode->reserved_cnt = 0;
+  inode->ra_pos = 0;
+  inode->ra_window = 0;
+  inode->ra_end = 0;
+  lock_acquire (&inode->lock);
+  lock_release (&open_inodes_lock);
+
+  cache_read_at (inode->sector, CACHE_INODE, &inode->data, 0,
+                 BLOCK_SECTOR_SIZE);
+  lock_release (&inode->lock);
   return inode;
 }
 
@@ -287,7 +1158,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -314,50 +1189,59 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  A removed
+     inode leaves the table at once, since its sector may be reused
+     as soon as it is released.  Otherwise the inode stays in the
+     table, marked closing, until its delayed blocks are placed, so
+     that opening it meanwhile waits and then reads what this close
+     leaves behind.  Either way only this thread may free it. */
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
-        {
-          struct inode_disk *disk_inode = get_disk_inode (inode);
-          ASSERT (disk_inode != NULL);
-
-          free_map_release (inode->sector);
-
-          struct indirect_block *indirect_block = NULL;
-          struct indirect_block *double_indirect_block = NULL;
-
-          size_t sectors = bytes_to_sectors (disk_inode->length);
-
-          if (sectors > NUM_DIRECT)
-            indirect_block = calloc (1, sizeof(struct indirect_block));
-          if (sectors > NUM_DIRECT + 128)
-            double_indirect_block = calloc (1, sizeof(struct indirect_block));
-
-          for (size_t i = 0; i < sectors; i++)
-          {
-            if (i >= NUM_DIRECT)
-              memset (indirect_block, 0, sizeof (struct indirect_block));
-            if (i >= NUM_DIRECT + 128)
-              memset (double_indirect_block, 0, sizeof (struct indirect_block));
-            block_sector_t sector = inode_block_to_sector (disk_inode, i, indirect_block,
-                        double_indirect_block, false);
-            if (sector != 0)
-              free_map_release (sector);
-          }
-
-          free (indirect_block);
-          free (double_indirect_block);
-
-          free (disk_inode);
-        }
-
-      free (inode);
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  if (inode->removed)
+    hash_delete (&open_inodes, &inode->elem);
+  else
+    inode->closing = true;
+  lock_acquire (&inode->lock);
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed, otherwise give delayed blocks
+     their sectors. */
+  if (inode->removed)
+    {
+      size_t i;
+
+      for (i = 0; i < inode->delayed_cnt; i++)
+        cache_discard (inode->delayed[i].sector);
+      free_map_unreserve (inode->reserved_cnt);
+      free_map_release (inode->sector, 1);
+      inode_release (&inode->data);
+      lock_release (&inode->lock);
     }
+  else
+    {
+      bool placed = inode_place_delayed (inode);
+      lock_release (&inode->lock);
+
+      /* An inode whose delayed blocks could not be placed stays in
+         the table, unopened, so that their data is not lost;
+         opening it picks it back up and inode_place_all() tries
+         again.  Either way, openers waiting on it can go on. */
+      lock_acquire (&open_inodes_lock);
+      inode->closing = false;
+      if (placed)
+        hash_delete (&open_inodes, &inode->elem);
+      cond_broadcast (&inode_closed, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      if (!placed)
+        return;
+    }
+
+  free (inode->dir_hints);
+  free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -369,6 +1253,66 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Updates INODE's read-ahead state for a read of SIZE bytes at
+   OFFSET, and queues prefetches for the file blocks that follow it.
+   Blocks are mapped through the inode, so the prefetched sectors
+   are the file's next blocks wherever they lie on disk.  A read that
+   does not start where the previous one ended shuts read-ahead
+   off. */
+static void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  enum cache_class class = data_class (inode->sector, &inode->data);
+  block_sector_t sectors[RA_MAX_WINDOW];
+  block_sector_t run_start = 0;
+  size_t run_cnt = 0;
+  size_t block, end, i;
+
+  if (offset != inode->ra_pos)
+    inode->ra_window = 0;
+  else if (inode->ra_window == 0)
+    inode->ra_window = RA_MIN_WINDOW;
+  else if (inode->ra_window < RA_MAX_WINDOW)
+    inode->ra_window *= 2;
+  inode->ra_pos = offset + size;
+
+  if (inode->ra_window == 0)
+    return;
+
+  block = (offset + size - 1) / BLOCK_SECTOR_SIZE + 1;
+  end = block + inode->ra_window;
+  if (end > bytes_to_sectors (inode->data.length))
+    end = bytes_to_sectors (inode->data.length);
+  if (inode->ra_end > block && inode->ra_end <= end)
+    block = inode->ra_end;
+  if (block >= end)
+    return;
+
+  /* Queue each physically contiguous run of blocks as one request,
+     so it can be read with a single disk command.  Holes have
+     nothing to prefetch. */
+  lock_acquire (&inode->lock);
+  inode_map_range (&inode->data, block, end - block, sectors);
+  lock_release (&inode->lock);
+  for (i = 0; i < end - block; i++)
+  {
+    if (run_cnt > 0 && sectors[i] != run_start + run_cnt)
+    {
+      cache_read_ahead (run_start, run_cnt, class);
+      run_cnt = 0;
+    }
+    if (sectors[i] != 0)
+    {
+      if (run_cnt == 0)
+        run_start = sectors[i];
+      run_cnt++;
+    }
+  }
+  if (run_cnt > 0)
+    cache_read_ahead (run_start, run_cnt, class);
+  inode->ra_end = end;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -377,39 +1321,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-
-  struct indirect_block *indirect_block = NULL;
-  struct indirect_block *double_indirect_block = NULL;
-
-  size_t sectors = bytes_to_sectors (size + offset);
-
-  if (sectors > NUM_DIRECT)
-    indirect_block = calloc (1, sizeof (struct indirect_block));
-
-  if (sectors > NUM_DIRECT + 128)
-    double_indirect_block = calloc (1, sizeof (struct indirect_block));
-
-  struct inode_disk *disk_inode = get_disk_inode (inode);
+  off_t start = offset;
+  off_t length = inode_length (inode);
+  enum cache_class class = data_class (inode->sector, &inode->data);
+  block_sector_t sectors[MAP_BATCH];
+  size_t map_start = 0, map_cnt = 0;
 
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      int block_idx = offset/BLOCK_SECTOR_SIZE;
-
-      if (block_idx >= NUM_DIRECT)
-        memset (indirect_block, 0, sizeof (struct indirect_block));
-      if (block_idx >= NUM_DIRECT + 128)
-        memset (double_indirect_block, 0, sizeof (struct indirect_block));
-
-      block_sector_t sector_idx = inode_block_to_sector (disk_inode, block_idx,
-                indirect_block, double_indirect_block, false);
-
-      //printf ("reading from sector_idx: %d, offset: %d, size %d\n", sector_idx, offset, size);
-
+      size_t block_idx = offset/BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -418,18 +1343,40 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_idx == 0 && inode_left > 0)
-      {
-        memset (buffer + bytes_read, 0, chunk_size);
-        size -= chunk_size;
-        offset += chunk_size;
-        bytes_read += chunk_size;
-        continue;
-      }
-      else if (sector_idx == 0)
-        goto done;
+      /* Map the next batch of the blocks the read covers. */
+      if (block_idx - map_start >= map_cnt)
+        {
+          off_t end = offset + (size < inode_left ? size : inode_left);
+          map_start = block_idx;
+          map_cnt = bytes_to_sectors (end) - block_idx;
+          if (map_cnt > MAP_BATCH)
+            map_cnt = MAP_BATCH;
+          lock_acquire (&inode->lock);
+          inode_map_range (&inode->data, map_start, map_cnt, sectors);
+          lock_release (&inode->lock);
+        }
+      block_sector_t sector_idx = sectors[block_idx - map_start];
 
-      cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      if (sector_idx == 0)
+        {
+          /* The block may be delayed, or may have been placed since
+             it was mapped, even if nothing is delayed any more.  A
+             placeholder is only valid while the lock keeps it from
+             being placed. */
+          lock_acquire (&inode->lock);
+          sector_idx = inode_block_to_sector (&inode->data, block_idx);
+          if (sector_idx == 0)
+            sector_idx = inode_delayed_sector (inode, block_idx);
+          if (sector_idx != 0)
+            cache_read_at (sector_idx, class, buffer + bytes_read,
+                           sector_ofs, chunk_size);
+          else
+            memset (buffer + bytes_read, 0, chunk_size);
+          lock_release (&inode->lock);
+        }
+      else
+        cache_read_at (sector_idx, class, buffer + bytes_read, sector_ofs,
+                       chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -437,100 +1384,91 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       bytes_read += chunk_size;
     }
 
-  done:
-    free (disk_inode);
-    free (indirect_block);
-    free (double_indirect_block);
-    return bytes_read;
+  if (bytes_read > 0)
+    inode_read_ahead (inode, start, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up.  A write past end of file
+   extends the inode; the new length is published only after the
+   data is in the cache, so readers never see the new blocks
+   before they are written.  Extending writes hold the inode's
+   extension lock throughout, so they publish their lengths in
+   order and a reader never sees a hole left by an extension that
+   has not finished yet; writes within the file and reads do not
+   take it.  New file data blocks get sectors
+   later, in bulk, when too many are pending or the inode is
+   closed, so small appends end up in contiguous runs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  bool allocated = false;
+  enum cache_class class = data_class (inode->sector, &inode->data);
+  block_sector_t sectors[MAP_BATCH];
+  size_t map_start = 0, map_cnt = 0;
+  bool extending;
 
   if (inode->deny_write_cnt)
     return 0;
 
-  struct indirect_block *indirect_block = NULL;
-  struct indirect_block *double_indirect_block = NULL;
-
-  size_t sectors = bytes_to_sectors (size + offset);
-
-  if (sectors > NUM_DIRECT)
-    indirect_block = calloc (1, sizeof (struct indirect_block));
-
-  if (sectors > NUM_DIRECT + 128)
-    double_indirect_block = calloc (1, sizeof (struct indirect_block));
-
-  struct inode_disk *disk_inode = get_disk_inode (inode);
+  /* The length only grows under the extension lock, so a write
+     found to lie within the file stays within it. */
+  extending = offset + size > inode_length (inode);
+  if (extending)
+    lock_acquire (&inode->extension_lock);
 
   while (size > 0)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      int block_idx = offset/BLOCK_SECTOR_SIZE;
-
+      /* Disk sector to write, starting byte offset within sector. */
+      size_t block_idx = offset/BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      //off_t inode_left = inode_length (inode) - offset;
+      /* Number of bytes to actually write into this sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      //int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually copy out of this sector. */
-      // int chunk_size = size < min_left ? size : min_left;
       int chunk_size = size < sector_left ? size : sector_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (block_idx >= NUM_DIRECT)
-        memset (indirect_block, 0, sizeof (struct indirect_block));
-      if (block_idx >= NUM_DIRECT + 128)
-        memset (double_indirect_block, 0, sizeof (struct indirect_block));
-
-      //printf ("offset = %d, chunk_size = %d, disk_inode->length: %d\n", offset, chunk_size, disk_inode->length);
-
-      if (offset + chunk_size > disk_inode->length)
-      {
-        //lock_acquire (&inode->extension_lock);
-        if (offset + chunk_size > disk_inode->length)
-        {
-          block_sector_t sector_idx = inode_block_to_sector (disk_inode, block_idx,
-                    indirect_block, double_indirect_block, true);
 
-          if (sector_idx == 0)
-            goto done;
-
-          disk_inode->length = offset + chunk_size;
-          //lock_release (&inode->extension_lock);
-          cache_write_at (inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-
-          //printf ("(extension) writing to sector_idx: %d, offset: %d, size %d\n", sector_idx, offset, size);
-          cache_write_at (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
-        }
-        else
+      /* Map the next batch of the blocks the write covers. */
+      lock_acquire (&inode->lock);
+      if (block_idx - map_start >= map_cnt)
         {
-          //lock_release (&inode->extension_lock);
+          map_start = block_idx;
+          map_cnt = bytes_to_sectors (offset + size) - block_idx;
+          if (map_cnt > MAP_BATCH)
+            map_cnt = MAP_BATCH;
+          inode_map_range (&inode->data, map_start, map_cnt, sectors);
         }
-      }
-      else
-      {
-        block_sector_t sector_idx = inode_block_to_sector (disk_inode, block_idx,
-                  indirect_block, double_indirect_block, true);
-
-        if (sector_idx == 0)
-          goto done;
+      block_sector_t sector_idx = sectors[block_idx - map_start];
+
+      /* Another writer may have filled the hole since it was
+         mapped.  Otherwise delay allocating the block if we can. */
+      if (sector_idx == 0)
+        sector_idx = inode_block_to_sector (&inode->data, block_idx);
+      if (sector_idx == 0)
+        sector_idx = inode_delayed_sector (inode, block_idx);
+      if (sector_idx == 0)
+        sector_idx = inode_delay_block (inode, block_idx);
+      if (sector_idx == 0
+          && inode_allocate (&inode->data, inode->sector, block_idx, 1, class,
+                             false, &sector_idx))
+        allocated = true;
+
+      /* A placeholder is only valid while the lock is held. */
+      if (sector_idx >= CACHE_DELAYED)
+        cache_write_at (sector_idx, class, buffer + bytes_written,
+                        sector_ofs, chunk_size);
+      lock_release (&inode->lock);
+
+      if (sector_idx == 0)
+        break;
 
-        //printf ("(non-extension) writing to sector_idx: %d, offset: %d, size %d\n", sector_idx, offset, size);
-        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
-      }
+      if (sector_idx < CACHE_DELAYED)
+        cache_write_at (sector_idx, class, buffer + bytes_written,
+                        sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -538,14 +1476,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
-  done:
-    free (disk_inode);
-
-    free (indirect_block);
-    free (double_indirect_block);
-    //printf ("bytes_written: %d\n", bytes_written);
-
-    return bytes_written;
+  if (allocated || offset > inode_length (inode))
+    {
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        inode->data.length = offset;
+      inode_write_through (inode);
+      lock_release (&inode->lock);
+    }
+  if (extending)
+    lock_release (&inode->extension_lock);
+  return bytes_written;
 }
 
 /* Disables writes to INODE.
@@ -572,50 +1513,79 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = get_disk_inode (inode);
-  ASSERT (disk_inode != NULL);
-  off_t ret = disk_inode->length;
-  free (disk_inode);
-  return ret;
+  /* A single aligned word, read without the lock. */
+  return inode->data.length;
 }
 
 bool
 inode_isdir (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = get_disk_inode (inode);
-  ASSERT (disk_inode != NULL);
-  bool ret = disk_inode->isdir;
-  free (disk_inode);
-  return ret;
+  return inode->data.isdir;
 }
 
 void
-inode_entrycnt_inc (const struct inode *inode)
+inode_entrycnt_inc (struct inode *inode)
 {
-  struct inode_disk *disk_inode = get_disk_inode (inode);
-  ASSERT (disk_inode != NULL);
-  disk_inode->entry_cnt++;
-  cache_write_at (inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-  free (disk_inode);
+  lock_acquire (&inode->lock);
+  inode->data.entry_cnt++;
+  inode_write_through (inode);
+  lock_release (&inode->lock);
 }
 
 void
-inode_entrycnt_dec (const struct inode *inode)
+inode_entrycnt_dec (struct inode *inode)
 {
-  struct inode_disk *disk_inode = get_disk_inode (inode);
-  ASSERT (disk_inode != NULL);
-  disk_inode->entry_cnt--;
-  ASSERT (disk_inode->entry_cnt >= 0);
-  cache_write_at (inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-  free (disk_inode);
+  lock_acquire (&inode->lock);
+  inode->data.entry_cnt--;
+  ASSERT (inode->data.entry_cnt >= 0);
+  inode_write_through (inode);
+  lock_release (&inode->lock);
 }
 
 bool
 inode_emptydir (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = get_disk_inode (inode);
-  ASSERT (disk_inode != NULL);
-  bool ret = disk_inode->entry_cnt == 0;
-  free (disk_inode);
-  return ret;
+  return inode->data.entry_cnt == 0;
+}
+
+/* Returns the number of entries in directory INODE, not counting
+   "." and "..". */
+int
+inode_entrycnt (const struct inode *inode)
+{
+  return inode->data.entry_cnt;
+}
+
+/* Locks directory INODE's entries against other directory
+   operations. */
+void
+inode_dir_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Unlocks directory INODE's entries. */
+void
+inode_dir_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the hints that the directory code keeps with directory
+   INODE while it is open, or a null pointer if it has none.
+   The caller must hold INODE's directory lock. */
+void *
+inode_dir_hints (const struct inode *inode)
+{
+  return inode->dir_hints;
+}
+
+/* Sets directory INODE's hints to HINTS, a block from malloc()
+   that INODE frees when it is closed for the last time.
+   The caller must hold INODE's directory lock. */
+void
+inode_set_dir_hints (struct inode *inode, void *hints)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  inode->dir_hints = hints;
 }
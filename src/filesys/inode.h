@@ -8,6 +8,10 @@
 struct bitmap;
 
 void inode_init (void);
+void inode_done (void);
+void inode_place_all (void);
+bool inode_configure_format (const char *name);
+void inode_adopt_format (block_sector_t);
 bool inode_create (block_sector_t, off_t, bool);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -21,8 +25,13 @@ void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 bool inode_isdir (const struct inode *);
-void inode_entrycnt_inc (const struct inode *);
-void inode_entrycnt_dec (const struct inode *);
+void inode_entrycnt_inc (struct inode *);
+void inode_entrycnt_dec (struct inode *);
 bool inode_emptydir (const struct inode *);
+int inode_entrycnt (const struct inode *);
+void inode_dir_lock (struct inode *);
+void inode_dir_unlock (struct inode *);
+void *inode_dir_hints (const struct inode *);
+void inode_set_dir_hints (struct inode *, void *);
 
 #endif /* filesys/inode.h */
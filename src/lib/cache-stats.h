@@ -0,0 +1,40 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, shared between the kernel and the
+   cachestat system call. */
+
+/* What a cached sector holds.  Replacement keeps metadata classes
+   resident in preference to file data. */
+enum cache_class
+  {
+    CACHE_DATA,                 /* Regular file data. */
+    CACHE_INODE,                /* On-disk inode. */
+    CACHE_INDIRECT,             /* Indirect or doubly indirect block. */
+    CACHE_DIR,                  /* Directory contents. */
+    CACHE_FREE_MAP,             /* Free map contents. */
+    CACHE_CLASS_CNT
+  };
+
+/* Counters for one sector class. */
+struct cache_class_stats
+  {
+    unsigned long long hit_cnt;         /* Accesses found in the cache. */
+    unsigned long long miss_cnt;        /* Accesses that went to disk. */
+    unsigned long long evict_cnt;       /* Sectors evicted. */
+    unsigned long long write_back_cnt;  /* Dirty sectors written back. */
+  };
+
+struct cache_stats
+  {
+    struct cache_class_stats classes[CACHE_CLASS_CNT];
+
+    unsigned long long read_ahead_cnt;  /* Sectors read ahead from disk. */
+    unsigned long long read_ahead_hit_cnt; /* ...later accessed. */
+    unsigned long long read_ahead_waste_cnt; /* ...evicted unused. */
+
+    unsigned long long lock_wait_cnt;   /* Contended lock acquisitions. */
+    unsigned long long lock_wait_ticks; /* Timer ticks spent waiting. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -0,0 +1,24 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <round.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Directory entry filled in by the getdents system call, shared
+   between the kernel and user programs.  Entries are packed one
+   after another, each RECLEN bytes long. */
+struct dirent
+  {
+    uint32_t inumber;                   /* Inode number. */
+    uint16_t reclen;                    /* Bytes to the next entry. */
+    uint8_t isdir;                      /* Nonzero for a directory. */
+    char name[];                        /* Null terminated file name. */
+  };
+
+/* Size of a struct dirent for a name of LEN characters, padded to
+   keep the next entry aligned. */
+#define DIRENT_SIZE(LEN) \
+        ROUND_UP (offsetof (struct dirent, name) + (LEN) + 1, 4)
+
+#endif /* lib/dirent.h */
@@ -358,6 +358,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file image that start at byte OFS
+   to the same place in FILE, stopping at the end of the image.
+   Returns true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file, size_t ofs,
+                    size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (size_t) file_write_at (file, (const uint8_t *) b->bits + ofs,
+                                 size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+cachestat (struct cache_stats *stats)
+{
+  return syscall1 (SYS_CACHESTAT, stats);
+}
+
+int
+getdents (int fd, void *buffer, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, fd, buffer, size);
+}
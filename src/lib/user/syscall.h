@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stats.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -13,7 +15,7 @@ typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
 /* Maximum characters in a filename written by readdir(). */
-#define READDIR_MAX_LEN 14
+#define READDIR_MAX_LEN 255
 
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
@@ -45,4 +47,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool cachestat (struct cache_stats *);
+int getdents (int fd, void *buffer, unsigned size);
+
 #endif /* lib/user/syscall.h */
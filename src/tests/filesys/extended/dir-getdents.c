@@ -0,0 +1,74 @@
+/* Creates files and a subdirectory in a directory, then lists it
+   with getdents() through a buffer too small to hold every entry
+   at once, and checks that each entry shows up exactly once with
+   the right inumber and type. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 20
+
+void
+test_main (void) 
+{
+  static uint32_t entries[16];
+  bool seen[FILE_CNT + 1];
+  char name[32];
+  int dir_fd, fd, size, cnt, i;
+
+  CHECK (mkdir ("/d"), "mkdir \"/d\"");
+  CHECK (mkdir ("/d/sub"), "mkdir \"/d/sub\"");
+  msg ("creating %d files in \"/d\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "/d/file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  CHECK ((dir_fd = open ("/d")) > 1, "open \"/d\"");
+  memset (seen, 0, sizeof seen);
+  cnt = 0;
+  while ((size = getdents (dir_fd, entries, sizeof entries)) > 0) 
+    {
+      const uint8_t *p = (const uint8_t *) entries;
+      const struct dirent *d;
+
+      for (; p < (const uint8_t *) entries + size; p += d->reclen) 
+        {
+          int idx;
+
+          d = (const struct dirent *) p;
+          if (!strcmp (d->name, "sub"))
+            idx = FILE_CNT;
+          else
+            {
+              idx = memcmp (d->name, "file", 4) ? -1 : atoi (d->name + 4);
+              if (idx < 0 || idx >= FILE_CNT)
+                fail ("unexpected entry \"%s\"", d->name);
+            }
+          if (seen[idx])
+            fail ("entry \"%s\" listed twice", d->name);
+          seen[idx] = true;
+          cnt++;
+
+          if (d->isdir != (idx == FILE_CNT))
+            fail ("entry \"%s\" has the wrong type", d->name);
+          snprintf (name, sizeof name, "/d/%s", d->name);
+          if ((fd = open (name)) < 2)
+            fail ("open \"%s\"", name);
+          if ((uint32_t) inumber (fd) != d->inumber)
+            fail ("entry \"%s\" has the wrong inumber", d->name);
+          close (fd);
+        }
+    }
+  CHECK (size == 0, "getdents returned 0 at end of directory");
+  CHECK (cnt == FILE_CNT + 1, "listed %d entries", cnt);
+  msg ("close \"/d\"");
+  close (dir_fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "/d"
+(dir-getdents) mkdir "/d/sub"
+(dir-getdents) creating 20 files in "/d"
+(dir-getdents) open "/d"
+(dir-getdents) getdents returned 0 at end of directory
+(dir-getdents) listed 21 entries
+(dir-getdents) close "/d"
+(dir-getdents) end
+EOF
+pass;
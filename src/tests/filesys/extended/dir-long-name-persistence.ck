@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'d'}{chr (ord ('a') + $_) x 90 . $_} = [''] foreach 1...7;
+check_archive ($fs);
+pass;
@@ -0,0 +1,87 @@
+/* Creates files whose names are much longer than the old 14-byte
+   limit, checks that they can be opened and listed by name,
+   removes one of them, and checks that names of exactly NAME_MAX
+   bytes are accepted and longer ones are rejected.  The names that
+   are left behind stay under the 99-byte limit of the ustar
+   archive used to check persistence. */
+
+#include <string.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 8
+#define NAME_LEN 90
+
+static void
+make_name (char *name, int idx) 
+{
+  memset (name, 'a' + idx, NAME_LEN);
+  snprintf (name + NAME_LEN, 4, "%d", idx);
+}
+
+void
+test_main (void) 
+{
+  char name[NAME_LEN + 4];
+  char entry[READDIR_MAX_LEN + 1];
+  char max_name[READDIR_MAX_LEN + 2];
+  bool seen[FILE_CNT];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("/d"), "mkdir \"/d\"");
+  CHECK (chdir ("/d"), "chdir \"/d\"");
+  msg ("creating %d files with %d-byte names", FILE_CNT, NAME_LEN + 1);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      make_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  msg ("opening each file by name");
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      make_name (name, i);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+
+  make_name (name, 0);
+  CHECK (remove (name), "remove the first file");
+  CHECK (open (name) == -1, "open removed file (must return -1)");
+
+  memset (max_name, 'z', READDIR_MAX_LEN);
+  max_name[READDIR_MAX_LEN] = '\0';
+  CHECK (create (max_name, 0), "create %d-byte name", READDIR_MAX_LEN);
+  CHECK ((fd = open (max_name)) > 1, "open %d-byte name", READDIR_MAX_LEN);
+  close (fd);
+  max_name[READDIR_MAX_LEN] = 'z';
+  max_name[READDIR_MAX_LEN + 1] = '\0';
+  CHECK (!create (max_name, 0),
+         "create %d-byte name (must return false)", READDIR_MAX_LEN + 1);
+  max_name[READDIR_MAX_LEN] = '\0';
+  CHECK (remove (max_name), "remove %d-byte name", READDIR_MAX_LEN);
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  memset (seen, 0, sizeof seen);
+  cnt = 0;
+  while (readdir (fd, entry)) 
+    {
+      for (i = 0; i < FILE_CNT; i++) 
+        {
+          make_name (name, i);
+          if (!strcmp (entry, name))
+            break;
+        }
+      if (i == 0 || i == FILE_CNT || seen[i])
+        fail ("unexpected entry \"%s\"", entry);
+      seen[i] = true;
+      cnt++;
+    }
+  CHECK (cnt == FILE_CNT - 1, "listed %d entries", cnt);
+  msg ("close \".\"");
+  close (fd);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-long-name) begin
+(dir-long-name) mkdir "/d"
+(dir-long-name) chdir "/d"
+(dir-long-name) creating 8 files with 91-byte names
+(dir-long-name) opening each file by name
+(dir-long-name) remove the first file
+(dir-long-name) open removed file (must return -1)
+(dir-long-name) create 255-byte name
+(dir-long-name) open 255-byte name
+(dir-long-name) create 256-byte name (must return false)
+(dir-long-name) remove 255-byte name
+(dir-long-name) open "."
+(dir-long-name) listed 7 entries
+(dir-long-name) close "."
+(dir-long-name) end
+EOF
+pass;
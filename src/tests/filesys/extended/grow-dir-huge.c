@@ -0,0 +1,45 @@
+/* Creates 10,000 files in one directory, then opens each of them
+   and tries to open as many names that do not exist.  A
+   directory that is searched linearly makes this take time
+   quadratic in the number of files. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10000
+
+void
+test_main (void) 
+{
+  char file_name[32];
+  int fd, i;
+
+  CHECK (mkdir ("/x"), "mkdir \"/x\"");
+
+  msg ("creating %d files in \"/x\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\"", file_name);
+    }
+
+  msg ("opening %d files in \"/x\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      if ((fd = open (file_name)) < 2)
+        fail ("open \"%s\"", file_name);
+      close (fd);
+    }
+
+  msg ("opening %d missing files in \"/x\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "/x/nofile%d", i);
+      if ((fd = open (file_name)) != -1)
+        fail ("open \"%s\" returned %d instead of -1", file_name, fd);
+    }
+}
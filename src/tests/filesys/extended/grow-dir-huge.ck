@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-dir-huge) begin
+(grow-dir-huge) mkdir "/x"
+(grow-dir-huge) creating 10000 files in "/x"
+(grow-dir-huge) opening 10000 files in "/x"
+(grow-dir-huge) opening 10000 missing files in "/x"
+(grow-dir-huge) end
+EOF
+pass;
@@ -0,0 +1,61 @@
+/* Grows a file to 12 MB, past the reach of double indirect
+   blocks, 64 kB at a time, then reads it back and checks its
+   contents.  Run on a 16 MB file system, so the file fills most
+   of the disk. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (12 * 1024 * 1024)
+#define CHUNK_SIZE (64 * 1024)
+static char buf[CHUNK_SIZE];
+static char data[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "huge";
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("writing \"%s\"", file_name);
+  random_init (0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) 
+    {
+      size_t ret_val;
+
+      random_bytes (buf, sizeof buf);
+      ret_val = write (fd, buf, sizeof buf);
+      if (ret_val != sizeof buf)
+        fail ("write %zu bytes at offset %zu in \"%s\" returned %zu",
+              sizeof buf, ofs, file_name, ret_val);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\" for verification",
+         file_name);
+  if (filesize (fd) != FILE_SIZE)
+    fail ("size of %s (%d) differs from expected (%d)",
+          file_name, filesize (fd), FILE_SIZE);
+  random_init (0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) 
+    {
+      size_t ret_val;
+
+      random_bytes (buf, sizeof buf);
+      ret_val = read (fd, data, sizeof data);
+      if (ret_val != sizeof data)
+        fail ("read of %zu bytes at offset %zu in \"%s\" returned %zu",
+              sizeof data, ofs, file_name, ret_val);
+      compare_bytes (data, buf, sizeof data, ofs, file_name);
+    }
+  msg ("verified contents of \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
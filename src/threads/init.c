@@ -36,8 +36,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -249,11 +251,29 @@ parse_options (char **argv)
         shutdown_configure (SHUTDOWN_REBOOT);
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          format_filesys = true;
+          if (value != NULL && !inode_configure_format (value))
+            PANIC ("unknown file system format `%s' (use -h for help)",
+                   value);
+        }
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_configure (atoi (value));
+      else if (!strcmp (name, "-cache-max"))
+        cache_configure_max (atoi (value));
+      else if (!strcmp (name, "-wb-interval"))
+        cache_configure_write_back (atoi (value));
+      else if (!strcmp (name, "-wb-ratio"))
+        cache_configure_dirty_ratio (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!cache_configure_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -377,9 +397,15 @@ usage (void)
           "  -q                 Power off VM after actions or on panic.\n"
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
-          "  -f                 Format file system device during startup.\n"
+          "  -f[=FORMAT]        Format file system device during startup,\n"
+          "                     with FORMAT inodes: indexed (default), extent.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Size the buffer cache to SECTORS sectors.\n"
+          "  -cache-max=SECTORS Let the cache grow to SECTORS from user memory.\n"
+          "  -wb-interval=MS    Write dirty cache sectors back every MS ms.\n"
+          "  -wb-ratio=PERCENT  Write back early once PERCENT of cache is dirty.\n"
+          "  -cache-policy=NAME Replace cache sectors by NAME: 2q (default), clock.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
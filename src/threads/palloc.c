@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,11 +32,13 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+static void adjust_free_cnt (struct pool *, size_t add, size_t sub);
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
@@ -79,6 +82,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    adjust_free_cnt (pool, 0, page_cnt);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -139,6 +144,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  adjust_free_cnt (pool, page_cnt, 0);
 }
 
 /* Frees the page at PAGE. */
@@ -148,6 +154,28 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_count_free (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return pool->free_cnt;
+}
+
+/* Adds ADD to POOL's count of free pages and subtracts SUB.
+   Pages are freed without the pool's lock, sometimes while a
+   dying thread is being scheduled away, so the count is updated
+   with interrupts off instead. */
+static void
+adjust_free_cnt (struct pool *pool, size_t add, size_t sub)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt = pool->free_cnt + add - sub;
+  intr_set_level (old_level);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -167,6 +195,7 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -418,3 +418,143 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A reader-writer lock may be held by any
+   number of readers at once, or by a single writer.  Readers that
+   arrive while a writer is waiting queue up behind it, so a steady
+   stream of readers cannot starve writers.
+
+   As with a lock, the thread that acquires a reader-writer lock
+   must release it, and a thread must not acquire one it already
+   holds in either mode. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers);
+  cond_init (&rwlock->writers);
+  rwlock->reader_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping while a writer holds it or
+   waits for it. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->waiting_writer_cnt > 0)
+    cond_wait (&rwlock->readers, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Tries to acquire RWLOCK for reading without waiting for a
+   writer.  Returns true if successful. */
+bool
+rwlock_try_acquire_read (struct rwlock *rwlock)
+{
+  bool success;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  success = rwlock->writer == NULL && rwlock->waiting_writer_cnt == 0;
+  if (success)
+    rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+  return success;
+}
+
+/* Acquires RWLOCK for writing, sleeping until no reader or writer
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->writer != NULL || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->writers, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Tries to acquire RWLOCK for writing without waiting.  Returns
+   true if successful. */
+bool
+rwlock_try_acquire_write (struct rwlock *rwlock)
+{
+  bool success;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  success = rwlock->writer == NULL && rwlock->reader_cnt == 0;
+  if (success)
+    rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+  return success;
+}
+
+/* Turns the current thread's write hold on RWLOCK into a read
+   hold, letting other readers in unless a writer is waiting. */
+void
+rwlock_downgrade (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_by_current_thread (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  rwlock->reader_cnt++;
+  if (rwlock->waiting_writer_cnt == 0)
+    cond_broadcast (&rwlock->readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, held by the current thread for writing if it is
+   the writer and otherwise for reading. */
+void
+rwlock_release (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  if (rwlock->writer == thread_current ())
+    rwlock->writer = NULL;
+  else
+    {
+      ASSERT (rwlock->reader_cnt > 0);
+      rwlock->reader_cnt--;
+    }
+
+  if (rwlock->reader_cnt == 0 && rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->writers, &rwlock->lock);
+  else if (rwlock->writer == NULL && rwlock->waiting_writer_cnt == 0)
+    cond_broadcast (&rwlock->readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing.
+   (Readers are not tracked individually.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
@@ -6,6 +6,7 @@
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "userprog/syscall_util.h"
+#include "filesys/directory.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
@@ -256,12 +257,26 @@ syscall_handler (struct intr_frame *f)
       int fd = *((int*)f->esp + 1);
       char *name = (char*)*((int*)f->esp + 2);
 
+      /* The name written can take all NAME_MAX + 1 bytes. */
       validate (name);
+      validate (name + NAME_MAX + 1 - 4);
 
       f->eax = readdir (fd, name);
       break;
     }
 
+    case SYS_GETDENTS:
+    {
+      validate3 (f->esp);
+
+      int fd = *((int*)f->esp + 1);
+      void *buffer = (void*)*((int*)f->esp + 2);
+      unsigned size = *((unsigned*)f->esp + 3);
+
+      f->eax = getdents (fd, buffer, size);
+      break;
+    }
+
     case SYS_ISDIR:
     {
       validate1 (f->esp);
@@ -282,6 +297,16 @@ syscall_handler (struct intr_frame *f)
       break;
     }
 
+    case SYS_CACHESTAT:
+    {
+      validate1 (f->esp);
+
+      struct cache_stats *stats = (struct cache_stats*)*((int*)f->esp + 1);
+
+      f->eax = cachestat (stats);
+      break;
+    }
+
     default:
     {
       ASSERT (0);
@@ -11,8 +11,10 @@
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "filesys/free-map.h"
+#include "filesys/cache.h"
 #include <console.h>
 #include <debug.h>
+#include <dirent.h>
 #include "devices/input.h"
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -521,13 +523,15 @@ mkdir (const char *dir)
     goto done;
   }
 
-  success = (free_map_allocate (&inode_sector)
+  /* Place the new directory near its parent. */
+  block_sector_t parent = inode_get_inumber (dir_get_inode (checkeddir));
+  success = (free_map_allocate (1, parent, &inode_sector)
               && dir_create (inode_sector, 0, checkeddir)
-              && dir_add (checkeddir, dirname, inode_sector));
+              && dir_add (checkeddir, dirname, inode_sector, true));
 
   done:
     if (!success && inode_sector != 0)
-      free_map_release (inode_sector);
+      free_map_release (inode_sector, 1);
     free (dir_copy);
     dir_close (checkeddir);
     return success;
@@ -547,18 +551,103 @@ readdir (int fd, char *name)
   if (inode_emptydir (inode))
     return false;
 
-  struct dir_entry e;
+  /* The file position is the directory position. */
+  struct dir *dir = dir_open (inode_reopen (inode));
+  struct dir_entry *e = malloc (sizeof *e);
+  bool success = false;
 
-  while (file_read (file, &e, sizeof e) == sizeof e)
+  if (dir == NULL || e == NULL)
     {
-      if (e.in_use && strcmp (e.name, ".") == 1 && strcmp (e.name, "..") == 1)
+      dir_close (dir);
+      free (e);
+      return false;
+    }
+  dir->pos = file_tell (file);
+  while (dir_readdir_entry (dir, e))
+    if (strcmp (e->name, ".") != 0 && strcmp (e->name, "..") != 0)
+      {
+        strlcpy (name, e->name, NAME_MAX + 1);
+        success = true;
+        break;
+      }
+  file_seek (file, dir->pos);
+  dir_close (dir);
+  free (e);
+
+  return success;
+}
+
+/* Fills BUFFER with as many of the entries that follow directory
+   FD's position, other than "." and "..", as fit in SIZE bytes,
+   and moves the position past them.  Returns the number of bytes
+   filled, 0 at the end of the directory, or -1 if FD is not a
+   directory or the next entry does not fit. */
+int
+getdents (int fd, void *buffer, unsigned size)
+{
+  struct file *file = fd_to_file (fd);
+  struct dir *dir;
+  struct dir_entry *e;
+  uint8_t *entries;
+  unsigned used = 0;
+  bool too_small = false;
+
+  if (file == NULL || !inode_isdir (file_get_inode (file)) || size < 4)
+    return -1;
+
+  /* Fill at most a page, checking the user range that is actually
+     written. */
+  if (size > PGSIZE)
+    size = PGSIZE;
+  if ((uintptr_t) buffer + size < (uintptr_t) buffer)
+    exit (-1);
+  validate (buffer);
+  validate ((uint8_t *) buffer + size - 4);
+
+  /* Fill a kernel buffer, then copy it out in one go. */
+  entries = malloc (size);
+  e = malloc (sizeof *e);
+  dir = dir_open (inode_reopen (file_get_inode (file)));
+  if (entries == NULL || e == NULL || dir == NULL)
+    {
+      free (entries);
+      free (e);
+      dir_close (dir);
+      return -1;
+    }
+
+  dir->pos = file_tell (file);
+  for (;;)
+    {
+      off_t pos = dir->pos;
+      struct dirent *d = (struct dirent *) (entries + used);
+      size_t len;
+
+      if (!dir_readdir_entry (dir, e))
+        break;
+      if (!strcmp (e->name, ".") || !strcmp (e->name, ".."))
+        continue;
+
+      len = strlen (e->name);
+      if (used + DIRENT_SIZE (len) > size)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          too_small = used == 0;
+          dir->pos = pos;
+          break;
         }
+      d->inumber = e->inode_sector;
+      d->reclen = DIRENT_SIZE (len);
+      d->isdir = e->isdir;
+      memcpy (d->name, e->name, len + 1);
+      used += d->reclen;
     }
+  file_seek (file, dir->pos);
+  dir_close (dir);
+  free (e);
 
-  return false;
+  memcpy (buffer, entries, used);
+  free (entries);
+  return too_small ? -1 : (int) used;
 }
 
 bool
@@ -577,6 +666,19 @@ inumber (int fd)
   return inode_get_inumber (file_get_inode (file));
 }
 
+bool
+cachestat (struct cache_stats *stats)
+{
+  struct cache_stats copy;
+
+  validate (stats);
+  validate ((uint8_t *) (stats + 1) - 4);
+
+  cache_get_stats (&copy);
+  memcpy (stats, &copy, sizeof copy);
+  return true;
+}
+
 void
 validate_sp (void *ptr)
 {
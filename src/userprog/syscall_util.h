@@ -4,6 +4,7 @@
 #include "threads/thread.h"
 #include "userprog/process.h"
 #include "threads/interrupt.h"
+#include <cache-stats.h>
 
 void halt (void);
 void exit (int);
@@ -23,8 +24,10 @@ void munmap (int);
 bool chdir (const char *);
 bool mkdir (const char *);
 bool readdir (int, char *);
+int getdents (int, void *, unsigned);
 bool isdir (int);
 int inumber (int);
+bool cachestat (struct cache_stats *);
 
 
 void validate_sp (void *);
@@ -6,6 +6,7 @@
 #include "userprog/syscall.h"
 #include "vm/swap.h"
 #include "threads/synch.h"
+#include "filesys/cache.h"
 
 static struct hash frame_table;
 static void *global_frame;
@@ -94,6 +95,10 @@ frame_alloc (enum palloc_flags flags)
 
   new->frame = palloc_get_page (flags);
 
+  // Take back pages lent to the buffer cache before swapping.
+  while (new->frame == NULL && (flags & PAL_USER) && cache_shrink ())
+    new->frame = palloc_get_page (flags);
+
   // Swap out.
   if (new->frame == NULL)
   {